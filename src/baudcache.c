@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "baudcache.h"
+#include "system.h"
+
+#if defined(WIN32)
+#include <windows.h>
+#include <process.h>
+#define getpid  _getpid
+#else
+#include <unistd.h>
+#endif
+
+#define MAXLINE     1024
+#define MAXKEY      256
+
+/* the cache is a text file with one line per device and board type:
+
+    <device> <board> <baud-rate> <failures> <successes>
+
+   where the device is a serial port name or a Wi-Fi module's MAC address
+*/
+static const char *CacheFilePath(void)
+{
+    static char path[PATH_MAX];
+    const char *p;
+
+    if ((p = getenv("PROPLOADER_BAUD_CACHE")) != NULL)
+        return p;
+#if defined(WIN32)
+    if ((p = getenv("APPDATA")) == NULL)
+        return NULL;
+    snprintf(path, sizeof(path), "%s%cproploader-baud-cache.txt", p, DIR_SEP);
+#else
+    if ((p = getenv("HOME")) == NULL)
+        return NULL;
+    snprintf(path, sizeof(path), "%s%c.proploader-baud-cache", p, DIR_SEP);
+#endif
+    return path;
+}
+
+/* MakeKeyField - copy a port or board name replacing characters that would break the line format */
+static void MakeKeyField(char *dst, const char *src)
+{
+    int i;
+    for (i = 0; src[i] != '\0' && i < MAXKEY - 1; ++i)
+        dst[i] = (src[i] == ' ' || src[i] == '\t' || src[i] == '\n' || src[i] == '\r') ? '_' : src[i];
+    dst[i] = '\0';
+}
+
+/* ReplaceCacheFile - replace the cache with a newly written copy in one step so a reader never sees it half written */
+static int ReplaceCacheFile(const char *tmpPath, const char *path)
+{
+#if defined(WIN32)
+    return MoveFileExA(tmpPath, path, MOVEFILE_REPLACE_EXISTING) ? 0 : -1;
+#else
+    return rename(tmpPath, path);
+#endif
+}
+
+/* ParseEntry - parse a cache line returning TRUE if it is for the specified port and board */
+static int ParseEntry(const char *line, const char *port, const char *board, BaudCacheEntry *entry)
+{
+    char linePort[MAXKEY], lineBoard[MAXKEY];
+    BaudCacheEntry lineEntry;
+    if (sscanf(line, "%255s %255s %d %d %d", linePort, lineBoard, &lineEntry.baudRate, &lineEntry.failures, &lineEntry.successes) != 5)
+        return FALSE;
+    if (strcmp(linePort, port) != 0 || strcmp(lineBoard, board) != 0)
+        return FALSE;
+    if (entry)
+        *entry = lineEntry;
+    return TRUE;
+}
+
+/* GetCachedBaudRate - get the cache entry for a port and board type */
+int GetCachedBaudRate(const char *port, const char *board, BaudCacheEntry *entry)
+{
+    char portKey[MAXKEY], boardKey[MAXKEY], line[MAXLINE];
+    const char *path;
+    int found = FALSE;
+    FILE *fp;
+
+    if (!(path = CacheFilePath()) || !(fp = fopen(path, "r")))
+        return FALSE;
+
+    MakeKeyField(portKey, port);
+    MakeKeyField(boardKey, board);
+    while (!found && fgets(line, sizeof(line), fp) != NULL)
+        found = ParseEntry(line, portKey, boardKey, entry);
+    fclose(fp);
+
+    return found && entry->baudRate > 0;
+}
+
+/* SetCachedBaudRate - add or replace the cache entry for a port and board type */
+int SetCachedBaudRate(const char *port, const char *board, const BaudCacheEntry *entry)
+{
+    char portKey[MAXKEY], boardKey[MAXKEY], line[MAXLINE], tmpPath[PATH_MAX];
+    char *others = NULL, *newOthers;
+    int othersLength = 0, lineLength;
+    const char *path;
+    FILE *fp;
+
+    if (!(path = CacheFilePath()))
+        return FALSE;
+
+    MakeKeyField(portKey, port);
+    MakeKeyField(boardKey, board);
+
+    /* keep the entries for other ports and boards */
+    if ((fp = fopen(path, "r")) != NULL) {
+        while (fgets(line, sizeof(line), fp) != NULL) {
+            if (ParseEntry(line, portKey, boardKey, NULL))
+                continue;
+            lineLength = strlen(line);
+            if (!(newOthers = realloc(others, othersLength + lineLength + 1))) {
+                fclose(fp);
+                free(others);
+                return FALSE;
+            }
+            others = newOthers;
+            strcpy(&others[othersLength], line);
+            othersLength += lineLength;
+        }
+        fclose(fp);
+    }
+
+    /* write the new cache to a file of this process's own and then put it in place of the old one; a load running
+       at the same time can still lose its update but neither can leave the cache truncated or interleaved */
+    snprintf(tmpPath, sizeof(tmpPath), "%s.%d", path, (int)getpid());
+    if (!(fp = fopen(tmpPath, "w"))) {
+        free(others);
+        return FALSE;
+    }
+    if (others) {
+        fputs(others, fp);
+        free(others);
+    }
+    fprintf(fp, "%s %s %d %d %d\n", portKey, boardKey, entry->baudRate, entry->failures, entry->successes);
+    if (fclose(fp) != 0 || ReplaceCacheFile(tmpPath, path) != 0) {
+        remove(tmpPath);
+        return FALSE;
+    }
+
+    return TRUE;
+}
@@ -0,0 +1,24 @@
+#ifndef __BAUDCACHE_H__
+#define __BAUDCACHE_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* number of successful loads at a cached baud rate before trying the next higher rate */
+#define BAUD_CACHE_PROBE_INTERVAL   16
+
+typedef struct {
+    int baudRate;       /* fast loader baud rate that last worked */
+    int failures;       /* number of load attempts that failed and had to step down */
+    int successes;      /* number of successful loads at baudRate since it was recorded */
+} BaudCacheEntry;
+
+int GetCachedBaudRate(const char *port, const char *board, BaudCacheEntry *entry);
+int SetCachedBaudRate(const char *port, const char *board, const BaudCacheEntry *entry);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
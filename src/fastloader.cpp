@@ -6,15 +6,76 @@
 #include "loader.h"
 #include "proploader.h"
 #include "propimage.h"
+#include "serialpropconnection.h"
+#include "baudcache.h"
+#include "loadtrace.h"
+#include "system.h"
 
 #define MAX_RX_SENSE_ERROR      23          /* Maximum number of cycles by which the detection of a start bit could be off (as affected by the Loader code) */
 
 // Offset (in bytes) from end of Loader Image pointing to where most host-initialized values exist.
 // Host-Initialized values are: Initial Bit Time, Final Bit Time, 1.5x Bit Time, Failsafe timeout,
-// End of Packet timeout, and ExpectedID.  In addition, the image checksum at word 5 needs to be
+// End of Packet timeout, Packet Limit, and ExpectedID.  In addition, the image checksum at word 5 needs to be
 // updated.  All these values need to be updated before the download stream is generated.
 // NOTE: DAT block data is always placed before the first Spin method
-#define RAW_LOADER_INIT_OFFSET_FROM_END (-(10 * 4) - 8)
+// NOTE: RAW_LOADER_INIT_OFFSET_FROM_END comes from IP_Loader.h; split computes it from where the overlays begin
+
+// Largest packet payload (in bytes) the Loader's packet buffer holds; IP_Loader.spin's MaxPayload less the packet
+// header (Packet ID and Transmission ID).
+#define LOADER_MAX_DATA_SIZE    (1392 - 2 * 4)
+
+// Address of the end of Main RAM (+1).
+#define MAIN_RAM_END            0x8000
+
+// Main RAM address of the windowed receiver's acknowledgement mailbox.  Windowed delivery writes each packet
+// straight to its place in Main RAM so the image must end at or below this address.
+#define WINDOW_MAILBOX          0x7ffc
+
+// Retransmission timeout limits (in milliseconds) for packets whose response only waits on the link.  The initial
+// timeout is used until a round trip has been measured; after that the timeout follows the measured latency.
+#define RTO_INITIAL             2000
+#define RTO_MIN                 20
+#define RTO_MAX                 2000
+
+// Number of times a packet is transmitted before giving up.  Once the timeout adapts to the link, it doubles after
+// each failure so a few more tries cost less than a single fixed timeout used to.
+#define MAX_TRANSMISSIONS           3
+#define MAX_ADAPTIVE_TRANSMISSIONS  5
+
+// Lowest fast loader baud rate to step down to before giving up on the fast loader.
+#define MIN_FAST_LOADER_BAUD_RATE   115200
+
+// Packet ID of the control packet that switches the running Loader to a new final baud rate.
+#define BAUD_PACKET_ID          ((int32_t)0x80000000)
+
+// Timeouts (in milliseconds) for executable packets that do some work on the target before responding.
+#define EXEC_PACKET_TIMEOUT     2000
+#define EEPROM_PACKET_TIMEOUT   8000
+
+// Clock cycles from the Loader's sampling of the last data bit of one byte to its first check for the next start bit
+// (the worst case crosses a long boundary; see the :RxWait timing notes in IP_Loader.spin) and the same path in the
+// windowed receiver.  This must fit within the 1.5 bit periods between that sample and the next start bit.
+#define LOADER_RX_GAP_CYCLES    88
+#define WINDOW_RX_GAP_CYCLES    119
+
+// Load planner estimates (in microseconds) of the Propeller reset (the reset pulse and the wait for the ROM boot
+// loader) and of programming and verifying the EEPROM, which take the same time with either loader.
+#define PLAN_RESET_TIME         110000
+#define PLAN_EEPROM_TIME        3000000
+
+// Shortest run of identical longs that compressImage encodes as a repeat.
+#define COMPRESS_MIN_RUN        3
+
+// Slack allowed for clock and UART baud rate error when choosing the fast loader baud rate automatically.
+#define AUTO_BAUD_MARGIN        1.05
+
+// Fast loader baud rates (highest first) to try when choosing one automatically and to step down through after
+// failures.  They are close enough together that a failure costs only part of the speed, not half of it.
+static const int fastLoaderBaudRates[] = {
+    3000000, 2500000, 2000000, 1500000, 1250000, 1152000, 1000000, 921600, 750000, 576000, 500000, 460800,
+    345600, 230400, 172800, 115200
+};
+#define FAST_LOADER_BAUD_RATE_COUNT ((int)(sizeof(fastLoaderBaudRates) / sizeof(fastLoaderBaudRates[0])))
 
 // Raw loader image.  This is a memory image of a Propeller Application written in PASM that fits into our initial
 // download packet.  Once started, it assists with the remainder of the download (at a faster speed and with more
@@ -26,6 +87,13 @@
 
 static uint8_t initCallFrame[] = {0xFF, 0xFF, 0xF9, 0xFF, 0xFF, 0xFF, 0xF9, 0xFF};
 
+// Executable packets are sent whole, so the Loader's payload limit can't be smaller than the largest of them.
+static const int execPacketSizes[] = {
+    sizeof(verifyRAM), sizeof(programVerifyEEPROM), sizeof(readyToLaunch), sizeof(launchNow), sizeof(startWindow),
+    sizeof(decompressImage)
+};
+#define EXEC_PACKET_SIZE_COUNT  ((int)(sizeof(execPacketSizes) / sizeof(execPacketSizes[0])))
+
 static void SetHostInitializedValue(uint8_t *bytes, int offset, int value)
 {
     for (int i = 0; i < 4; ++i)
@@ -45,15 +113,44 @@ static void setLong(uint8_t *buf, uint32_t value)
      buf[0] = value;
 }
 
+// The low word of a transmission tag is the packet ID.  The second-stage loader only echoes the tag back
+// but its windowed receiver hands nothing else to the cog that sends the acknowledgements.
+static int32_t newTag(int id)
+{
+    return (int32_t)(((uint32_t)rand() << 16) | ((uint32_t)id & 0xffff));
+}
+
+// Loader timing values for the final baud rate: bit period, 1.5x bit period less the maximum start bit sense error,
+// and End of Packet timeout (2 bytes worth of Loader's Receive loop iterations).
+static int FinalBitTime(double clockSpeed, int baudRate)
+{
+    return (int)trunc(clockSpeed / baudRate + 0.5);
+}
+
+static int FinalBitTime1_5(double clockSpeed, int baudRate)
+{
+    return (int)trunc(1.5 * clockSpeed / baudRate - MAX_RX_SENSE_ERROR + 0.5);
+}
+
+static int EndOfPacketTimeout(double clockSpeed, int baudRate)
+{
+    return (int)trunc(2.0 * clockSpeed / baudRate * 10.0 / 12.0 + 0.5);
+}
+
 double ClockSpeed = 80000000.0;
 
-uint8_t *Loader::generateInitialLoaderImage(int clockSpeed, int clockMode, int packetID, int loaderBaudRate, int fastLoaderBaudRate, int *pLength)
+uint8_t *Loader::generateInitialLoaderImage(int clockSpeed, int clockMode, int packetID, int packetDataSize, int loaderBaudRate, int fastLoaderBaudRate, int *pLength)
 {
     int initAreaOffset = sizeof(rawLoaderImage) + RAW_LOADER_INIT_OFFSET_FROM_END;
     double floatClockSpeed = (double)clockSpeed;
     uint8_t *loaderImage;
     int checksum, i;
     
+    // The template's example Packet Limit is the Loader's buffer size; anything else means the host-initialized
+    // values aren't where RAW_LOADER_INIT_OFFSET_FROM_END points
+    if (getLong(rawLoaderImage + initAreaOffset + 36) != LOADER_MAX_DATA_SIZE / 4)
+        return NULL;
+
     // Allocate space for the image
     if (!(loaderImage = (uint8_t *)malloc(sizeof(rawLoaderImage))))
         return NULL;
@@ -76,7 +173,8 @@ uint8_t *Loader::generateInitialLoaderImage(int clockSpeed, int clockMode, int p
       PatchLoaderLongValue(RawSize*4+RawLoaderInitOffset + 24, Max(Round(ClockSpeed * SSSHTime), 14));              {Minimum EEPROM Start/Stop Condition setup/hold time (400 KHz = 1/0.6 µS); Minimum 14 cycles}
       PatchLoaderLongValue(RawSize*4+RawLoaderInitOffset + 28, Max(Round(ClockSpeed * SCLHighTime), 14));           {Minimum EEPROM SCL high time (400 KHz = 1/0.6 µS); Minimum 14 cycles}
       PatchLoaderLongValue(RawSize*4+RawLoaderInitOffset + 32, Max(Round(ClockSpeed * SCLLowTime), 26));            {Minimum EEPROM SCL low time (400 KHz = 1/1.3 µS); Minimum 26 cycles}
-      PatchLoaderLongValue(RawSize*4+RawLoaderInitOffset + 36, PacketID);                                           {First Expected Packet ID; total packet count}
+      PatchLoaderLongValue(RawSize*4+RawLoaderInitOffset + 36, PacketLimit);                                        {Maximum packet payload (in longs)}
+      PatchLoaderLongValue(RawSize*4+RawLoaderInitOffset + 40, PacketID);                                           {First Expected Packet ID; total packet count}
 */
 
     // Clock mode
@@ -86,16 +184,16 @@ uint8_t *Loader::generateInitialLoaderImage(int clockSpeed, int clockMode, int p
     SetHostInitializedValue(loaderImage, initAreaOffset +  4, (int)trunc(floatClockSpeed / loaderBaudRate + 0.5));
 
     // Final Bit Time.
-    SetHostInitializedValue(loaderImage, initAreaOffset +  8, (int)trunc(floatClockSpeed / fastLoaderBaudRate + 0.5));
+    SetHostInitializedValue(loaderImage, initAreaOffset +  8, FinalBitTime(floatClockSpeed, fastLoaderBaudRate));
     
     // 1.5x Final Bit Time minus maximum start bit sense error.
-    SetHostInitializedValue(loaderImage, initAreaOffset + 12, (int)trunc(1.5 * floatClockSpeed / fastLoaderBaudRate - MAX_RX_SENSE_ERROR + 0.5));
+    SetHostInitializedValue(loaderImage, initAreaOffset + 12, FinalBitTime1_5(floatClockSpeed, fastLoaderBaudRate));
     
     // Failsafe Timeout (seconds-worth of Loader's Receive loop iterations).
     SetHostInitializedValue(loaderImage, initAreaOffset + 16, (int)trunc(2.0 * floatClockSpeed / (3 * 4) + 0.5));
     
     // EndOfPacket Timeout (2 bytes worth of Loader's Receive loop iterations).
-    SetHostInitializedValue(loaderImage, initAreaOffset + 20, (int)trunc(2.0 * floatClockSpeed / fastLoaderBaudRate * 10.0 / 12.0 + 0.5));
+    SetHostInitializedValue(loaderImage, initAreaOffset + 20, EndOfPacketTimeout(floatClockSpeed, fastLoaderBaudRate));
     
     const double SSSHTime    = 0.0000006;
     const double SCLHighTime = 0.0000006;
@@ -125,8 +223,11 @@ uint8_t *Loader::generateInitialLoaderImage(int clockSpeed, int clockMode, int p
     // Minimum EEPROM SCL low time (400 KHz = 1/1.3 µS); Minimum 26 cycles
     SetHostInitializedValue(loaderImage, initAreaOffset + 32, SCLLowTicks);
 
+    // Maximum packet payload (in longs).
+    SetHostInitializedValue(loaderImage, initAreaOffset + 36, packetDataSize / 4);
+
     // First Expected Packet ID; total packet count.
-    SetHostInitializedValue(loaderImage, initAreaOffset + 36, packetID);
+    SetHostInitializedValue(loaderImage, initAreaOffset + 40, packetID);
 
     // Recalculate and update checksum so low byte of checksum calculates to 0.
     checksum = 0;
@@ -166,6 +267,8 @@ int Loader::fastLoadImage(const uint8_t *image, int imageSize, LoadType loadType
 {
     int sts;
     
+    LoadTraceBegin(GetConfigField(m_connection->config(), "load-trace"), "fast", m_connection->portName(), m_connection->receiveLatency());
+
     // get the binary clock settings
     PropImage img((uint8_t *)image, imageSize); // shouldn't really modify image!
     int binaryClockSpeed = img.clkFreq();
@@ -210,28 +313,360 @@ int Loader::fastLoadImage(const uint8_t *image, int imageSize, LoadType loadType
             gotClockMode ? clockMode : binaryClockMode);
     
     // get the loader baudrates
-    int loaderBaudRate, fastLoaderBaudRate;
+    int loaderBaudRate, fastLoaderBaudRate, window;
+    const char *value;
     if (!GetNumericConfigField(m_connection->config(), "loader-baud-rate", &loaderBaudRate))
         loaderBaudRate = DEF_LOADER_BAUDRATE;
-    if (!GetNumericConfigField(m_connection->config(), "fast-loader-baud-rate", &fastLoaderBaudRate))
+    if ((value = GetConfigField(m_connection->config(), "fast-loader-baud-rate")) != NULL && strcasecmp(value, "auto") == 0) {
+        if (!GetNumericConfigField(m_connection->config(), "fast-loader-window", &window))
+            window = 1;
+        fastLoaderBaudRate = autoFastLoaderBaudRate(fastLoaderClockSpeed, window > 1);
+    }
+    else if (!GetNumericConfigField(m_connection->config(), "fast-loader-baud-rate", &fastLoaderBaudRate))
         fastLoaderBaudRate = DEF_FAST_LOADER_BAUDRATE;
 
+    // start at the baud rate that last worked on this port unless it's time to try the next higher one
+    int useBaudCache, steppedDown = false;
+    const char *boardType;
+    BaudCacheEntry cacheEntry;
+    if (!GetNumericConfigField(m_connection->config(), "baud-cache", &useBaudCache))
+        useBaudCache = true;
+    if (!(boardType = GetConfigField(m_connection->config(), "board-type")))
+        boardType = DEF_BOARD;
+    if (!useBaudCache || !GetCachedBaudRate(m_connection->deviceId(), boardType, &cacheEntry))
+        memset(&cacheEntry, 0, sizeof(cacheEntry));
+    else if (cacheEntry.baudRate < fastLoaderBaudRate) {
+        int higherBaudRate = higherFastLoaderBaudRate(cacheEntry.baudRate);
+        if (cacheEntry.successes >= BAUD_CACHE_PROBE_INTERVAL && higherBaudRate && higherBaudRate < fastLoaderBaudRate)
+            fastLoaderBaudRate = higherBaudRate;
+        else if (cacheEntry.successes < BAUD_CACHE_PROBE_INTERVAL)
+            fastLoaderBaudRate = cacheEntry.baudRate;
+        message("Using fast loader baud rate %d (last worked at %d)", fastLoaderBaudRate, cacheEntry.baudRate);
+    }
+    
+    // checksum the image (and compress it if that's enabled) on a worker thread while the second-stage loader is
+    // delivered; fastLoadImageHelper waits for the results when it needs them
+    ImagePrep prep;
+    int compress;
+    prep.image = image;
+    prep.imageSize = ((SpinHdr *)image)->vbase;
+    prep.compress = GetNumericConfigField(m_connection->config(), "fast-loader-compress", &compress) && compress;
+    prep.stream = NULL;
+    prep.streamSize = 0;
+    prep.pending = true;
+    prep.threaded = pthread_create(&prep.thread, NULL, prepareImage, &prep) == 0;
+    if (!prep.threaded)
+        prepareImage(&prep);
+
     for (;;) {
-        if ((sts = fastLoadImageHelper(image, imageSize, loadType, fastLoaderClockSpeed, fastLoaderClockMode, loaderBaudRate, fastLoaderBaudRate)) == 0)
-            return 0;
+        int startBaudRate = fastLoaderBaudRate;
+        sts = fastLoadImageHelper(image, imageSize, &prep, loadType, fastLoaderClockSpeed, fastLoaderClockMode, loaderBaudRate, &fastLoaderBaudRate);
+        if (fastLoaderBaudRate != startBaudRate) {
+            ++cacheEntry.failures;
+            steppedDown = true;
+        }
+        if (sts == 0) {
+            if (useBaudCache) {
+                if (fastLoaderBaudRate == cacheEntry.baudRate && !steppedDown)
+                    ++cacheEntry.successes;
+                else {
+                    cacheEntry.baudRate = fastLoaderBaudRate;
+                    cacheEntry.successes = 0;
+                }
+                SetCachedBaudRate(m_connection->deviceId(), boardType, &cacheEntry);
+            }
+            break;
+        }
         else if (sts == -2) {
-            if ((fastLoaderBaudRate /= 2) >= 115200)
+            ++cacheEntry.failures;
+            steppedDown = true;
+            if ((fastLoaderBaudRate = lowerFastLoaderBaudRate(fastLoaderBaudRate)) != 0)
                 nmessage(INFO_STEPPING_DOWN_BAUD_RATE, fastLoaderBaudRate);
             else
                 break;
         }
         else
-            return sts;
+            break;
+    }
+    
+    finishImagePrep(&prep);
+    if (prep.stream)
+        free(prep.stream);
+    if (sts != -2) {
+        LoadTraceEnd(sts);
+        return sts;
+    }
+    
+    /* remember the failures even though no fast loader baud rate worked */
+    if (useBaudCache && cacheEntry.baudRate > 0) {
+        cacheEntry.successes = 0;
+        SetCachedBaudRate(m_connection->deviceId(), boardType, &cacheEntry);
     }
         
     /* try a slow load if all baud rates failed */
     nmessage(INFO_USING_SINGLE_STAGE_LOADER);
-    return m_connection->loadImage(image, imageSize, loadType, true);
+    sts = m_connection->loadImage(image, imageSize, loadType, true);
+    LoadTraceEnd(sts);
+    return sts;
+}
+
+/* planWireTime - microseconds needed to send a number of bytes at a baud rate */
+static int64_t planWireTime(int byteCount, int baudRate)
+{
+    return (int64_t)byteCount * 10 * 1000000 / baudRate;
+}
+
+/* planLoad - predict how long the ROM loader and the fast loader would take to load an image and choose the faster
+
+   The predictions add up the time on the wire for each loader's PDS encoded download stream and packets and a round
+   trip latency for each response waited for, using the measured latency if the connection has one or a typical
+   value for the transport if not.  Nothing is sent to the target.
+*/
+int Loader::planLoad(const uint8_t *image, int imageSize, LoadType loadType, LoadPlan *plan)
+{
+    int64_t rtt = m_connection->roundTripTimeEstimate();
+    int loaderBaudRate, fastLoaderBaudRate, clockSpeed, window, compress, streamSize, loaderImageSize, execPackets;
+    int64_t romTime, fastTime;
+    uint8_t *loaderImage, *stream;
+    const char *value;
+    
+    memset(plan, 0, sizeof(LoadPlan));
+    
+    if (!GetNumericConfigField(m_connection->config(), "loader-baud-rate", &loaderBaudRate))
+        loaderBaudRate = DEF_LOADER_BAUDRATE;
+    plan->loaderBaudRate = loaderBaudRate;
+    
+    /* the ROM loader sends the whole image PDS encoded at the loader baud rate and then polls for its checksum */
+    if (imageSize > m_connection->maxRomImageSize())
+        plan->romTime = -1;
+    else {
+        if ((plan->romLoadSize = SerialPropConnection::romLoadSize(image, imageSize, loadType)) < 0) {
+            nerror(ERROR_INTERNAL_CODE_ERROR);
+            return -1;
+        }
+        romTime = PLAN_RESET_TIME + planWireTime(plan->romLoadSize, loaderBaudRate) + rtt;
+        if (loadType & ltDownloadAndProgram)
+            romTime += PLAN_EEPROM_TIME;
+        plan->romTime = (int)(romTime / 1000);
+    }
+    
+    /* get the clock speed the fast loader runs at */
+    if (!GetNumericConfigField(m_connection->config(), "fast-loader-clkfreq", &clockSpeed)
+    &&  !GetNumericConfigField(m_connection->config(), "clkfreq", &clockSpeed)) {
+        PropImage img((uint8_t *)image, imageSize);
+        clockSpeed = img.clkFreq();
+    }
+    
+    /* get the fast loader baud rate, packet size and window the same way fastLoadImage does */
+    if (!GetNumericConfigField(m_connection->config(), "fast-loader-window", &window) || window < 1)
+        window = 1;
+    if ((value = GetConfigField(m_connection->config(), "fast-loader-baud-rate")) != NULL && strcasecmp(value, "auto") == 0)
+        fastLoaderBaudRate = autoFastLoaderBaudRate(clockSpeed, window > 1);
+    else if (!GetNumericConfigField(m_connection->config(), "fast-loader-baud-rate", &fastLoaderBaudRate))
+        fastLoaderBaudRate = DEF_FAST_LOADER_BAUDRATE;
+    plan->fastLoaderBaudRate = fastLoaderBaudRate;
+    plan->packetDataSize = maxPacketDataSize();
+    
+    /* the fast loader sends the image up to vbase, compressed if that's enabled and it helps */
+    plan->fastDataSize = ((SpinHdr *)image)->vbase;
+    plan->compressed = false;
+    if (GetNumericConfigField(m_connection->config(), "fast-loader-compress", &compress) && compress) {
+        if ((stream = compressImage(image, plan->fastDataSize, &streamSize)) != NULL) {
+            plan->fastDataSize = streamSize;
+            plan->compressed = true;
+            free(stream);
+        }
+    }
+    plan->packetCount = (plan->fastDataSize + plan->packetDataSize - 1) / plan->packetDataSize;
+    if (window > 1 && plan->fastDataSize > WINDOW_MAILBOX)
+        window = 1;
+    
+    /* the second-stage loader goes to the ROM boot loader like any other image and then acknowledges its start */
+    loaderImage = generateInitialLoaderImage(clockSpeed, 0, window > 1 ? 0 : plan->packetCount, plan->packetDataSize, loaderBaudRate, fastLoaderBaudRate, &loaderImageSize);
+    if (!loaderImage) {
+        nerror(ERROR_INTERNAL_CODE_ERROR);
+        return -1;
+    }
+    plan->secondStageLoadSize = SerialPropConnection::romLoadSize(loaderImage, loaderImageSize, ltDownloadAndRun);
+    free(loaderImage);
+    if (plan->secondStageLoadSize < 0) {
+        nerror(ERROR_INTERNAL_CODE_ERROR);
+        return -1;
+    }
+    fastTime = PLAN_RESET_TIME + planWireTime(plan->secondStageLoadSize, loaderBaudRate) + 2 * rtt;
+    
+    /* each packet has an 8 byte header and an 8 byte response; a window only waits for a round trip per window */
+    fastTime += planWireTime(plan->fastDataSize + plan->packetCount * 2 * 2 * sizeof(uint32_t), fastLoaderBaudRate);
+    if (window > 1)
+        fastTime += ((plan->packetCount + window - 1) / window + 2) * rtt;
+    else
+        fastTime += plan->packetCount * rtt;
+    
+    /* then decompressImage, verifyRAM and readyToLaunch each wait for a response; launchNow doesn't */
+    execPackets = (plan->compressed ? 1 : 0) + 2;
+    fastTime += execPackets * (rtt + planWireTime(3 * 2 * sizeof(uint32_t), fastLoaderBaudRate));
+    if (loadType & ltDownloadAndProgram)
+        fastTime += PLAN_EEPROM_TIME + rtt;
+    plan->fastTime = (int)(fastTime / 1000);
+    
+    plan->useFastLoader = plan->romTime < 0 || plan->fastTime < plan->romTime;
+    return 0;
+}
+
+/* prepareImage - checksum and optionally compress an image (the body of the image preparation thread) */
+void *Loader::prepareImage(void *data)
+{
+    ImagePrep *prep = (ImagePrep *)data;
+    int i;
+    
+    prep->checksum = 0;
+    for (i = 0; i < prep->imageSize; ++i)
+        prep->checksum += prep->image[i];
+    for (i = 0; i < (int)sizeof(initCallFrame); ++i)
+        prep->checksum += initCallFrame[i];
+    
+    if (prep->compress)
+        prep->stream = compressImage(prep->image, prep->imageSize, &prep->streamSize);
+    
+    return NULL;
+}
+
+/* finishImagePrep - wait for the image preparation to finish */
+void Loader::finishImagePrep(ImagePrep *prep)
+{
+    if (!prep->pending)
+        return;
+    if (prep->threaded)
+        pthread_join(prep->thread, NULL);
+    prep->pending = false;
+    
+    if (prep->compress) {
+        if (prep->stream)
+            message("Compressed image from %d to %d bytes", prep->imageSize, prep->streamSize);
+        else
+            message("Image doesn't compress - sending it as is");
+    }
+}
+
+/* compressImage - run-length encode an image for the decompressImage packet
+
+   The stream is a series of longs.  Each starts with a count long followed by that many literal longs or, if bit 31 of
+   the count is set, by one long to repeat that many times.  A zero count ends the stream.  The target moves the stream
+   to the end of Main RAM and expands it from there to $0000 so this returns NULL if the expanded image would overwrite
+   stream longs before they're read or if the stream isn't smaller than the image.
+*/
+uint8_t *Loader::compressImage(const uint8_t *image, int imageSize, int *pStreamSize)
+{
+    int imageLongs = (imageSize + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+    int streamLongs, literalStart, run, i;
+    uint8_t *longs, *stream;
+    int32_t in, out;
+    
+    /* pad the image to a whole number of longs (zero padding doesn't change the checksum) */
+    if (!(longs = (uint8_t *)calloc(imageLongs, sizeof(uint32_t))))
+        return NULL;
+    memcpy(longs, image, imageSize);
+    
+    /* the stream is never more than one long per image long plus a count and the end marker */
+    if (!(stream = (uint8_t *)malloc((imageLongs + 2) * sizeof(uint32_t)))) {
+        free(longs);
+        return NULL;
+    }
+#define IMAGE_LONG(i)   (&longs[(i) * sizeof(uint32_t)])
+#define STREAM_LONG(i)  (&stream[(i) * sizeof(uint32_t)])
+
+    /* encode runs of MIN_RUN or more identical longs; collect everything else into literal counts */
+    streamLongs = 0;
+    literalStart = 0;
+    for (i = 0; i <= imageLongs; i += run) {
+        run = 1;
+        if (i < imageLongs) {
+            while (i + run < imageLongs && memcmp(IMAGE_LONG(i), IMAGE_LONG(i + run), sizeof(uint32_t)) == 0)
+                ++run;
+            if (run < COMPRESS_MIN_RUN)
+                continue;
+        }
+        if (i > literalStart) {
+            setLong(STREAM_LONG(streamLongs++), i - literalStart);
+            memcpy(STREAM_LONG(streamLongs), IMAGE_LONG(literalStart), (i - literalStart) * sizeof(uint32_t));
+            streamLongs += i - literalStart;
+        }
+        if (i < imageLongs) {
+            setLong(STREAM_LONG(streamLongs++), 0x80000000 | run);
+            memcpy(STREAM_LONG(streamLongs++), IMAGE_LONG(i), sizeof(uint32_t));
+        }
+        literalStart = i + run;
+    }
+    setLong(STREAM_LONG(streamLongs++), 0);
+    free(longs);
+    
+    /* check that expanding the stream from the end of Main RAM never overtakes it */
+    out = 0;
+    for (i = 0; i < streamLongs - 1; ) {
+        uint32_t count = getLong(STREAM_LONG(i));
+        if (count & 0x80000000) {
+            out += (count & 0x7fffffff) * sizeof(uint32_t);
+            i += 2;
+        }
+        else {
+            out += count * sizeof(uint32_t);
+            i += 1 + count;
+        }
+        in = MAIN_RAM_END - (streamLongs - i) * sizeof(uint32_t);
+        if (out > in)
+            break;
+    }
+    
+#undef IMAGE_LONG
+#undef STREAM_LONG
+
+    if (i < streamLongs - 1 || (int)(streamLongs * sizeof(uint32_t)) >= imageSize) {
+        free(stream);
+        return NULL;
+    }
+    
+    *pStreamSize = streamLongs * sizeof(uint32_t);
+    return stream;
+}
+
+/* autoFastLoaderBaudRate - choose the highest fast loader baud rate the Loader can receive at this clock speed
+   and the connection supports */
+int Loader::autoFastLoaderBaudRate(int clockSpeed, bool windowed)
+{
+    int gapCycles = windowed ? WINDOW_RX_GAP_CYCLES : LOADER_RX_GAP_CYCLES;
+    double minBitTime = AUTO_BAUD_MARGIN * gapCycles / 1.5;
+    int i;
+    
+    for (i = 0; i < FAST_LOADER_BAUD_RATE_COUNT; ++i) {
+        if ((double)clockSpeed / fastLoaderBaudRates[i] >= minBitTime && m_connection->baudRateSupported(fastLoaderBaudRates[i])) {
+            message("Using fast loader baud rate %d for a clock speed of %d", fastLoaderBaudRates[i], clockSpeed);
+            return fastLoaderBaudRates[i];
+        }
+    }
+    
+    /* the lowest rate is always worth a try */
+    return fastLoaderBaudRates[i - 1];
+}
+
+/* lowerFastLoaderBaudRate - next fast loader baud rate below baudRate that the connection supports (0 if none) */
+int Loader::lowerFastLoaderBaudRate(int baudRate)
+{
+    for (int i = 0; i < FAST_LOADER_BAUD_RATE_COUNT; ++i) {
+        if (fastLoaderBaudRates[i] < baudRate && fastLoaderBaudRates[i] >= MIN_FAST_LOADER_BAUD_RATE
+        &&  m_connection->baudRateSupported(fastLoaderBaudRates[i]))
+            return fastLoaderBaudRates[i];
+    }
+    return 0;
+}
+
+/* higherFastLoaderBaudRate - next fast loader baud rate above baudRate that the connection supports (0 if none) */
+int Loader::higherFastLoaderBaudRate(int baudRate)
+{
+    for (int i = FAST_LOADER_BAUD_RATE_COUNT; --i >= 0; ) {
+        if (fastLoaderBaudRates[i] > baudRate && m_connection->baudRateSupported(fastLoaderBaudRates[i]))
+            return fastLoaderBaudRates[i];
+    }
+    return 0;
 }
 
 /* returns:
@@ -239,28 +674,44 @@ int Loader::fastLoadImage(const uint8_t *image, int imageSize, LoadType loadType
     -1 for fatal errors
     -2 for errors where a lower baud rate might help
 */
-int Loader::fastLoadImageHelper(const uint8_t *image, int imageSize, LoadType loadType, int clockSpeed, int clockMode, int loaderBaudRate, int fastLoaderBaudRate)
+int Loader::fastLoadImageHelper(const uint8_t *image, int imageSize, ImagePrep *prep, LoadType loadType, int clockSpeed, int clockMode, int loaderBaudRate, int *pFastLoaderBaudRate)
 {
     uint8_t *loaderImage, response[8];
-    int loaderImageSize, remaining, result, sts, i;
-    int32_t packetID, checksum;
+    int loaderImageSize, dataSize, packetDataSize, remaining, result, window, sts, offset;
+    int fastLoaderBaudRate = *pFastLoaderBaudRate;
+    int32_t packetID, packetCount, checksum;
     SpinHdr *hdr = (SpinHdr *)image;
+    const uint8_t *data;
+    int64_t phaseStart;
 
     // don't need to load beyond this even for .eeprom images
     imageSize = hdr->vbase;
     
-    /* compute the image checksum */
-    checksum = 0;
-    for (i = 0; i < imageSize; ++i)
-        checksum += image[i];
-    for (i = 0; i < (int)sizeof(initCallFrame); ++i)
-        checksum += initCallFrame[i];
+    /* get the largest packet payload both ends can handle */
+    packetDataSize = maxPacketDataSize();
+
+    /* get the number of packets that can be in flight at once */
+    if (!GetNumericConfigField(m_connection->config(), "fast-loader-window", &window) || window < 1)
+        window = 1;
+        
+    /* the packet count depends on the size of the compressed stream but a window opens without it */
+    if (window == 1 || imageSize > WINDOW_MAILBOX)
+        finishImagePrep(prep);
+    if (window > 1 && !prep->pending && (prep->stream ? prep->streamSize : imageSize) > WINDOW_MAILBOX) {
+        message("Image too large for windowed delivery - sending one packet at a time");
+        window = 1;
+    }
     
-    /* compute the packet ID (number of packets to be sent) */
-    packetID = (imageSize + m_connection->maxDataSize() - 1) / m_connection->maxDataSize();
+    /* compute the packet ID (number of packets to be sent); a window is opened by executable packet 0 */
+    if (window > 1)
+        packetID = 0;
+    else {
+        dataSize = prep->stream ? prep->streamSize : imageSize;
+        packetID = (dataSize + packetDataSize - 1) / packetDataSize;
+    }
 
     /* generate a loader image */
-    loaderImage = generateInitialLoaderImage(clockSpeed, clockMode, packetID, loaderBaudRate, fastLoaderBaudRate, &loaderImageSize);
+    loaderImage = generateInitialLoaderImage(clockSpeed, clockMode, packetID, packetDataSize, loaderBaudRate, fastLoaderBaudRate, &loaderImageSize);
     if (!loaderImage) {
         message("generateInitialLoaderImage failed");
         nerror(ERROR_INTERNAL_CODE_ERROR);
@@ -269,7 +720,9 @@ int Loader::fastLoadImageHelper(const uint8_t *image, int imageSize, LoadType lo
         
     /* load the second-stage loader using the Propeller ROM protocol */
     message("Delivering second-stage loader");
+    phaseStart = LoadTraceTime();
     result = m_connection->loadImage(loaderImage, loaderImageSize, response, sizeof(response));
+    LoadTracePhase("second-stage", phaseStart, loaderImageSize, loaderBaudRate);
     free(loaderImage);
     if (result != 0)
         return result;
@@ -281,39 +734,89 @@ int Loader::fastLoadImageHelper(const uint8_t *image, int imageSize, LoadType lo
     }
 
     /* switch to the final baud rate */
-    m_connection->setBaudRate(fastLoaderBaudRate);
+    phaseStart = LoadTraceTime();
+    if (m_connection->setBaudRate(fastLoaderBaudRate) != 0) {
+        message("Can't switch the connection to %d baud", fastLoaderBaudRate);
+        return -2;
+    }
+    LoadTracePhase("set-baud-rate", phaseStart, 0, fastLoaderBaudRate);
     
     /* open the transparent serial connection that will be used for the second-stage loader */
+    phaseStart = LoadTraceTime();
     if (m_connection->connect() != 0) {
         message("Failed to connect to target");
         nerror(ERROR_COMMUNICATION_LOST);
         return -1;
     }
+    LoadTracePhase("connect", phaseStart, 0, fastLoaderBaudRate);
+    
+    /* collect the prepared image; send the compressed stream in place of the image if there is one */
+    finishImagePrep(prep);
+    data = prep->stream ? prep->stream : image;
+    dataSize = prep->stream ? prep->streamSize : imageSize;
+    checksum = prep->checksum;
 
     /* transmit the image */
     nmessage(INFO_DOWNLOADING, m_connection->portName());
-    remaining = imageSize;
+    phaseStart = LoadTraceTime();
+    packetCount = packetID;
+    if (window > 1) {
+        if ((sts = transmitWindow(data, dataSize, packetDataSize, window)) != 0)
+            return sts;
+        remaining = 0;
+    }
+    else
+        remaining = dataSize;
     while (remaining > 0) {
         int size;
         nprogress(INFO_BYTES_REMAINING, (long)remaining);
-        if ((size = remaining) > m_connection->maxDataSize())
-            size = m_connection->maxDataSize();
-        if ((sts = transmitPacket(packetID, image, size, &result)) != 0)
-            return -2;
-        if (result != packetID - 1) {
+        if ((size = remaining) > packetDataSize)
+            size = packetDataSize;
+        if ((sts = transmitPacket(packetID, data, size, &result)) == 0 && result == packetID - 1) {
+            remaining -= size;
+            data += size;
+            --packetID;
+            continue;
+        }
+        if (sts == -1)
+            return sts;
+        if (sts == 0)
             message("Unexpected response: expected %d, received %d", packetID - 1, result);
+
+        /* timeout or NAK; lower the baud rate and carry on from the packet the Loader still expects */
+        if ((sts = stepDownBaudRate(clockSpeed, &fastLoaderBaudRate, &packetID)) != 0)
+            return sts;
+        *pFastLoaderBaudRate = fastLoaderBaudRate;
+        if (packetID < 1 || packetID > packetCount) {
+            message("Can't resume: Loader expects packet %d", packetID);
             return -2;
         }
-        remaining -= size;
-        image += size;
+        offset = (packetCount - packetID) * packetDataSize;
+        data = (prep->stream ? prep->stream : image) + offset;
+        remaining = dataSize - offset;
+    }
+    nmessage(INFO_BYTES_SENT, (long)dataSize);
+    LoadTracePhase("transmit", phaseStart, dataSize, fastLoaderBaudRate);
+    
+    /* expand the compressed stream into the image */
+    if (prep->stream) {
+        message("Sending decompressImage packet");
+        phaseStart = LoadTraceTime();
+        if (transmitPacket(packetID, decompressImage, sizeof(decompressImage), &result, EXEC_PACKET_TIMEOUT) != 0)
+            return -1;
+        if (result != packetID - 1) {
+            message("DecompressImage failed: expected %d, received %d", packetID - 1, result);
+            return -1;
+        }
+        LoadTracePhase("decompress", phaseStart, sizeof(decompressImage), fastLoaderBaudRate);
         --packetID;
     }
-    nmessage(INFO_BYTES_SENT, (long)imageSize);
     
     /*
         When we're doing a download that does not include an EEPROM write, the Packet IDs end up as:
 
-        ltVerifyRAM: zero
+        ltDecompressImage: zero (only when sending a compressed stream)
+        ltVerifyRAM: zero (or -1 after ltDecompressImage)
         ltReadyToLaunch: -Checksum
         ltLaunchNow: -Checksum - 1
 
@@ -327,30 +830,35 @@ int Loader::fastLoadImageHelper(const uint8_t *image, int imageSize, LoadType lo
     
     /* transmit the RAM verify packet and verify the checksum */
     nmessage(INFO_VERIFYING_RAM);
-    if ((sts = transmitPacket(packetID, verifyRAM, sizeof(verifyRAM), &result)) != 0)
-        return sts;
+    phaseStart = LoadTraceTime();
+    if (transmitPacket(packetID, verifyRAM, sizeof(verifyRAM), &result, EXEC_PACKET_TIMEOUT) != 0)
+        return -1;
     if (result != -checksum) {
         nmessage(ERROR_RAM_CHECKSUM_FAILED);
         return -1;
     }
+    LoadTracePhase("verify-ram", phaseStart, sizeof(verifyRAM), fastLoaderBaudRate);
     packetID = -checksum;
     
     if (loadType & ltDownloadAndProgram) {
         nmessage(INFO_PROGRAMMING_EEPROM);
-        if ((sts = transmitPacket(packetID, programVerifyEEPROM, sizeof(programVerifyEEPROM), &result, 8000)) != 0)
-            return sts;
+        phaseStart = LoadTraceTime();
+        if (transmitPacket(packetID, programVerifyEEPROM, sizeof(programVerifyEEPROM), &result, EEPROM_PACKET_TIMEOUT) != 0)
+            return -1;
         if (result != -checksum*2) {
             nmessage(ERROR_EEPROM_CHECKSUM_FAILED);
             return -1;
         }
+        LoadTracePhase("program-verify-eeprom", phaseStart, sizeof(programVerifyEEPROM), fastLoaderBaudRate);
         packetID = -checksum*2;
     }
     
     /* transmit the final launch packets */
     
     message("Sending readyToLaunch packet");
-    if ((sts = transmitPacket(packetID, readyToLaunch, sizeof(readyToLaunch), &result)) != 0)
-        return sts;
+    phaseStart = LoadTraceTime();
+    if (transmitPacket(packetID, readyToLaunch, sizeof(readyToLaunch), &result, EXEC_PACKET_TIMEOUT) != 0)
+        return -1;
     if (result != packetID - 1) {
         message("ReadyToLaunch failed: expected %08x, got %08x", packetID - 1, result);
         return -1;
@@ -358,14 +866,119 @@ int Loader::fastLoadImageHelper(const uint8_t *image, int imageSize, LoadType lo
     --packetID;
     
     message("Sending launchNow packet");
-    if ((sts = transmitPacket(packetID, launchNow, sizeof(launchNow), NULL)) != 0)
-        return sts;
+    if (transmitPacket(packetID, launchNow, sizeof(launchNow), NULL) != 0)
+        return -1;
+    LoadTracePhase("launch", phaseStart, sizeof(readyToLaunch) + sizeof(launchNow), fastLoaderBaudRate);
     
     /* return successfully */
     return 0;
 }
 
-/* returns:
+/* stepDownBaudRate - switch the running Loader and the connection to the next lower fast loader baud rate
+
+   On success, *pPacketID is the packet the Loader expects next.
+
+   returns:
+    0 for success
+    -1 for fatal errors
+    -2 if the Loader couldn't be switched
+*/
+int Loader::stepDownBaudRate(int clockSpeed, int *pBaudRate, int32_t *pPacketID)
+{
+    uint8_t payload[3 * sizeof(uint32_t)];
+    int baudRate = lowerFastLoaderBaudRate(*pBaudRate);
+    int64_t phaseStart;
+    int result;
+    
+    if (!baudRate)
+        return -2;
+    nmessage(INFO_STEPPING_DOWN_BAUD_RATE, baudRate);
+    
+    /* the Loader acknowledges at the old baud rate and then switches */
+    phaseStart = LoadTraceTime();
+    setLong(&payload[0], FinalBitTime(clockSpeed, baudRate));
+    setLong(&payload[4], FinalBitTime1_5(clockSpeed, baudRate));
+    setLong(&payload[8], EndOfPacketTimeout(clockSpeed, baudRate));
+    if (transmitPacket(BAUD_PACKET_ID, payload, sizeof(payload), &result) != 0) {
+        message("Baud rate control packet failed");
+        return -2;
+    }
+    if (m_connection->setBaudRate(baudRate) != 0) {
+        nerror(ERROR_FAILED_TO_SET_BAUD_RATE);
+        return -1;
+    }
+    LoadTracePhase("step-down", phaseStart, sizeof(payload), baudRate);
+    
+    *pBaudRate = baudRate;
+    *pPacketID = result;
+    return 0;
+}
+
+/* maxPacketDataSize - largest packet payload both the connection and the Loader's packet buffer can handle */
+int Loader::maxPacketDataSize()
+{
+    int size = m_connection->maxDataSize();
+    int limit;
+
+    if (size > LOADER_MAX_DATA_SIZE)
+        size = LOADER_MAX_DATA_SIZE;
+    if (GetNumericConfigField(m_connection->config(), "fast-loader-packet-size", &limit) && limit > 0 && limit < size)
+        size = limit;
+
+    /* the Loader receives whole longs */
+    size &= ~3;
+
+    /* but must still accept every executable packet */
+    for (int i = 0; i < EXEC_PACKET_SIZE_COUNT; ++i) {
+        if (size < execPacketSizes[i])
+            size = execPacketSizes[i];
+    }
+
+    return size;
+}
+
+/* wireTime - microseconds needed to send a number of bytes at the current baud rate */
+int64_t Loader::wireTime(int byteCount)
+{
+    if (m_connection->baudRate() <= 0)
+        return 0;
+    return (int64_t)byteCount * 10 * 1000000 / m_connection->baudRate();
+}
+
+/* retransmitTimeout - milliseconds to wait for a response to byteCount bytes sent and received
+
+   The part of the timeout beyond the time on the wire is the smoothed round trip latency plus four times its
+   deviation like TCP's RTO, multiplied by backoff after timeouts.
+*/
+int Loader::retransmitTimeout(int byteCount, int backoff)
+{
+    int64_t rto;
+    if (!m_connection->haveRoundTripTime())
+        rto = RTO_INITIAL;
+    else {
+        rto = (m_connection->smoothedRoundTripTime() + 4 * m_connection->roundTripTimeDeviation() + 999) / 1000;
+        if (rto < RTO_MIN)
+            rto = RTO_MIN;
+        if ((rto *= backoff) > RTO_MAX)
+            rto = RTO_MAX;
+    }
+    return (int)((wireTime(byteCount) + 999) / 1000 + rto);
+}
+
+/* addRoundTripSample - update the round trip latency from a response received at 'now' to a transmission that was
+   finished sending (if it was all on the wire at once) at 'sendTime' */
+void Loader::addRoundTripSample(int64_t sendTime, int64_t now, int byteCount)
+{
+    int64_t sample = now - sendTime - wireTime(byteCount);
+    m_connection->addRoundTripSample(sample < 0 ? 0 : (int)sample);
+}
+
+/* transmitPacket - transmit a packet and wait for its response
+
+   The timeout is in milliseconds.  A timeout of zero waits for the response as long as the measured round trip time
+   suggests and should be used for packets that the target answers without delay.
+
+   returns:
     0 for success
     -1 for fatal errors
     -2 for errors where a lower baud rate might help
@@ -373,66 +986,244 @@ int Loader::fastLoadImageHelper(const uint8_t *image, int imageSize, LoadType lo
 int Loader::transmitPacket(int id, const uint8_t *payload, int payloadSize, int *pResult, int timeout)
 {
     int packetSize = 2*sizeof(uint32_t) + payloadSize;
-    uint8_t *packet, response[8];
-    int retries, result;
+    uint8_t header[8], response[8];
+    struct iovec packet[2];
+    int maxTransmissions, transmissions, backoff, result;
+    int64_t firstSendTime, sendTime, deadline, now, rtt;
+    bool adaptive = timeout <= 0;
     int32_t tag, rtag;
     
-    /* build the packet to transmit */
-    if (!(packet = (uint8_t *)malloc(packetSize))) {
-        nmessage(ERROR_INSUFFICIENT_MEMORY);
-        return -1;
-    }
-    setLong(&packet[0], id);
-    memcpy(&packet[8], payload, payloadSize);
+    /* the packet is the header followed by the payload where it already is */
+    setLong(&header[0], id);
+    packet[0].iov_base = header;
+    packet[0].iov_len = sizeof(header);
+    packet[1].iov_base = (void *)payload;
+    packet[1].iov_len = payloadSize;
     
     /* send the packet */
-    retries = 3;
-    while (--retries >= 0) {
+    maxTransmissions = adaptive && m_connection->haveRoundTripTime() ? MAX_ADAPTIVE_TRANSMISSIONS : MAX_TRANSMISSIONS;
+    transmissions = maxTransmissions;
+    firstSendTime = LoadTraceTime();
+    backoff = 1;
+    while (--transmissions >= 0) {
     
         /* setup the packet header */
-#ifdef __MINGW32__
-        tag = (int32_t)rand() | ((int32_t)rand() << 16);
-#else
-        tag = (int32_t)rand();
-#endif
-        setLong(&packet[4], tag);
-        //printf("transmit packet %d - tag %08x, size %d\n", id, tag, packetSize);
-        if (m_connection->sendData(packet, packetSize) != packetSize) {
+        tag = newTag(id);
+        setLong(&header[4], tag);
+        if (adaptive)
+            timeout = retransmitTimeout(packetSize + sizeof(response), backoff);
+        //printf("transmit packet %d - tag %08x, size %d, timeout %d\n", id, tag, packetSize, timeout);
+        sendTime = xbMonotonicMicros();
+        deadline = xbDeadline(timeout);
+        if (m_connection->sendDataV(packet, 2) != packetSize) {
             nmessage(ERROR_INTERNAL_CODE_ERROR);
-            free(packet);
             return -1;
         }
     
-        /* receive the response */
+        /* receive the response skipping late responses to earlier transmissions */
         if (pResult) {
-            if (m_connection->receiveDataExactTimeout(response, sizeof(response), timeout) != sizeof(response))
-                message("transmitPacket %d failed - receiveDataExactTimeout", id);
-            else if ((rtag = getLong(&response[4])) == tag) {
-                if ((result = getLong(&response[0])) == id)
-                    message("transmitPacket %d failed: duplicate id", id);
-                else {
-                    *pResult = result;
-                    free(packet);
-                    return 0;
+            do {
+                if (m_connection->receiveDataExactDeadline(response, sizeof(response), deadline) != sizeof(response)) {
+                    message("transmitPacket %d failed - receiveDataExactDeadline", id);
+                    break;
                 }
-            }
-            else
-                message("transmitPacket %d failed: wrong tag %08x - expected %08x", id, rtag, tag);
+                now = xbMonotonicMicros();
+                if ((rtag = getLong(&response[4])) == tag) {
+                    if ((result = getLong(&response[0])) == id)
+                        message("transmitPacket %d failed: duplicate id", id);
+                    else {
+                        if (adaptive)
+                            addRoundTripSample(sendTime, now, packetSize + sizeof(response));
+                        rtt = now - sendTime - wireTime(packetSize);
+                        LoadTracePacket(id, firstSendTime, packetSize, maxTransmissions - transmissions, rtt < 0 ? 0 : rtt, m_connection->baudRate());
+                        *pResult = result;
+                        return 0;
+                    }
+                    break;
+                }
+                message("transmitPacket %d ignoring response with wrong tag %08x - expected %08x", id, rtag, tag);
+            } while (now < deadline);
         }
         
         /* don't wait for a result */
         else {
-            free(packet);
+            LoadTracePacket(id, firstSendTime, packetSize, 1, -1, m_connection->baudRate());
             return 0;
         }
         message("transmitPacket %d failed - retrying", id);
+        backoff *= 2;
     }
     
-    /* free the packet */
-    free(packet);
+    LoadTracePacket(id, firstSendTime, packetSize, maxTransmissions, -1, m_connection->baudRate());
     
     /* return timeout */
     message("transmitPacket %d failed - timeout", id);
-    return -1;
+    return -2;
 }
 
+
+/* sendWindowPacket - send one windowed packet; its third header long holds the payload size in longs
+   (high word) and the Main RAM address of the payload (low word)
+
+   On entry *pLineFree is the time the previous packet should be finished sending.  It is updated for this packet.
+*/
+int Loader::sendWindowPacket(int id, int32_t tag, const uint8_t *image, int offset, int size, int64_t *pLineFree)
+{
+    int longs = size / sizeof(uint32_t);
+    int packetSize = 3*sizeof(uint32_t) + longs*sizeof(uint32_t);
+    int64_t now = xbMonotonicMicros();
+    uint8_t header[3*sizeof(uint32_t)];
+    struct iovec packet[2];
+    *pLineFree = (*pLineFree > now ? *pLineFree : now) + wireTime(packetSize);
+    setLong(&header[0], id);
+    setLong(&header[4], tag);
+    setLong(&header[8], (longs << 16) | offset);
+    packet[0].iov_base = header;
+    packet[0].iov_len = sizeof(header);
+    packet[1].iov_base = (void *)&image[offset];
+    packet[1].iov_len = longs*sizeof(uint32_t);
+    if (m_connection->sendDataV(packet, 2) != packetSize) {
+        nmessage(ERROR_INTERNAL_CODE_ERROR);
+        return -1;
+    }
+    return 0;
+}
+
+/* transmitWindow - deliver the image with up to 'window' packets awaiting acknowledgement
+
+   The StartWindow packet hands reception over to a second cog that writes each packet straight to Main RAM.
+   Packets are numbered from packetCount+1 down to 2 and each acknowledgement is matched to its packet by the
+   transmission tag.  Packets still unacknowledged when an acknowledgement times out are sent again.  Packet 1
+   closes the window, leaving the second-stage loader expecting packet 0 as usual.
+
+   returns:
+    0 for success
+    -1 for fatal errors
+    -2 for errors where a lower baud rate might help
+*/
+int Loader::transmitWindow(const uint8_t *image, int imageSize, int packetDataSize, int window)
+{
+    int dataSize = packetDataSize - sizeof(uint32_t);
+    int packetCount = (imageSize + dataSize - 1) / dataSize;
+    uint8_t startPayload[sizeof(startWindow)], closePayload[4], response[8];
+    int oldest, next, remaining, result, timeout, backoff, sts, i;
+    struct WindowEntry {
+        int32_t tag;        // tag of the latest transmission
+        int64_t firstTime;  // time the first transmission was queued
+        int64_t sentTime;   // time the latest transmission should be finished sending
+        int transmissions;  // number of times the packet has been sent
+        bool acked;         // true once the packet has been acknowledged
+    } *entries;
+    int64_t lineFree, now;
+    int32_t rtag;
+
+    /* open the window */
+    memcpy(startPayload, startWindow, sizeof(startWindow));
+    setLong(&startPayload[4], imageSize);
+    setLong(&startPayload[8], WINDOW_MAILBOX);
+    if ((sts = transmitPacket(0, startPayload, sizeof(startWindow), &result, EXEC_PACKET_TIMEOUT)) != 0)
+        return -2;
+    if (result != -1) {
+        message("StartWindow failed: expected -1, received %d", result);
+        return -2;
+    }
+    
+    /* setup the packet table */
+    if (!(entries = (WindowEntry *)calloc(packetCount, sizeof(WindowEntry)))) {
+        nmessage(ERROR_INSUFFICIENT_MEMORY);
+        return -1;
+    }
+#define WINDOW_PACKET_ID(i)     (packetCount + 1 - (i))
+#define WINDOW_PACKET_SIZE(i)   ((i) < packetCount - 1 ? dataSize : imageSize - (i) * dataSize)
+
+    /* send packets until all of them have been acknowledged */
+    remaining = imageSize;
+    oldest = next = 0;
+    lineFree = 0;
+    backoff = 1;
+    sts = 0;
+    while (sts == 0 && oldest < packetCount) {
+    
+        /* fill the window */
+        while (sts == 0 && next < packetCount && next - oldest < window) {
+            entries[next].tag = newTag(WINDOW_PACKET_ID(next));
+            entries[next].transmissions = 1;
+            entries[next].firstTime = LoadTraceTime();
+            sts = sendWindowPacket(WINDOW_PACKET_ID(next), entries[next].tag, image, next * dataSize, WINDOW_PACKET_SIZE(next), &lineFree);
+            entries[next].sentTime = lineFree;
+            ++next;
+        }
+        if (sts != 0)
+            break;
+        
+        /* wait for the next acknowledgement allowing for the packets still waiting to go out */
+        nprogress(INFO_BYTES_REMAINING, (long)remaining);
+        now = xbMonotonicMicros();
+        timeout = retransmitTimeout(sizeof(response), backoff) + (lineFree > now ? (int)((lineFree - now) / 1000) : 0);
+        if (m_connection->receiveDataExactTimeout(response, sizeof(response), timeout) != sizeof(response)) {
+            message("transmitWindow timeout - resending packets %d to %d", WINDOW_PACKET_ID(oldest), WINDOW_PACKET_ID(next - 1));
+            backoff *= 2;
+            for (i = oldest; sts == 0 && i < next; ++i) {
+                if (!entries[i].acked) {
+                    if (++entries[i].transmissions > (m_connection->haveRoundTripTime() ? MAX_ADAPTIVE_TRANSMISSIONS : MAX_TRANSMISSIONS)) {
+                        message("transmitWindow packet %d failed - timeout", WINDOW_PACKET_ID(i));
+                        LoadTracePacket(WINDOW_PACKET_ID(i), entries[i].firstTime, 3*sizeof(uint32_t) + WINDOW_PACKET_SIZE(i),
+                                        entries[i].transmissions - 1, -1, m_connection->baudRate());
+                        sts = -2;
+                    }
+                    else {
+                        entries[i].tag = newTag(WINDOW_PACKET_ID(i));
+                        sts = sendWindowPacket(WINDOW_PACKET_ID(i), entries[i].tag, image, i * dataSize, WINDOW_PACKET_SIZE(i), &lineFree);
+                        entries[i].sentTime = lineFree;
+                    }
+                }
+            }
+            continue;
+        }
+        
+        /* find the packet being acknowledged */
+        now = xbMonotonicMicros();
+        rtag = getLong(&response[4]);
+        for (i = oldest; i < next; ++i)
+            if (!entries[i].acked && entries[i].tag == rtag)
+                break;
+        if (i >= next) {
+            message("transmitWindow ignoring acknowledgement with tag %08x", rtag);
+            continue;
+        }
+        if ((result = getLong(&response[0])) != WINDOW_PACKET_ID(i) - 1) {
+            message("Unexpected response: expected %d, received %d", WINDOW_PACKET_ID(i) - 1, result);
+            continue;
+        }
+        
+        /* the tag identifies the transmission so every acknowledgement gives a round trip sample */
+        addRoundTripSample(entries[i].sentTime, now, sizeof(response));
+        LoadTracePacket(WINDOW_PACKET_ID(i), entries[i].firstTime, 3*sizeof(uint32_t) + WINDOW_PACKET_SIZE(i),
+                        entries[i].transmissions, now > entries[i].sentTime ? now - entries[i].sentTime : 0, m_connection->baudRate());
+        backoff = 1;
+        
+        /* slide the window past the acknowledged packets */
+        entries[i].acked = true;
+        remaining -= WINDOW_PACKET_SIZE(i);
+        while (oldest < next && entries[oldest].acked)
+            ++oldest;
+    }
+    
+#undef WINDOW_PACKET_ID
+#undef WINDOW_PACKET_SIZE
+
+    free(entries);
+    if (sts != 0)
+        return sts;
+
+    /* close the window (a packet with an empty payload) */
+    memset(closePayload, 0, sizeof(closePayload));
+    if ((sts = transmitPacket(1, closePayload, sizeof(closePayload), &result)) != 0)
+        return -2;
+    if (result != 0) {
+        message("Closing window failed: expected 0, received %d", result);
+        return -2;
+    }
+    
+    return 0;
+}
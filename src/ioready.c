@@ -0,0 +1,235 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#ifdef LINUX
+#include <sys/epoll.h>
+#endif
+
+#include "ioready.h"
+
+/* number of descriptors a set can hold (the terminals need two) */
+#define IOREADY_MAX_FDS     4
+
+struct IoReadySet {
+#ifdef LINUX
+    int epfd;
+    int polled;     /* holds a descriptor epoll can't wait on (a regular file) */
+#endif
+    int count;
+    int fds[IOREADY_MAX_FDS];
+    int events[IOREADY_MAX_FDS];
+};
+
+/* sets for registered descriptors indexed by descriptor */
+static IoReadySet **registered = NULL;
+static int registeredMax = 0;
+static pthread_mutex_t registeredLock = PTHREAD_MUTEX_INITIALIZER;
+
+#ifdef LINUX
+
+static uint32_t EpollEvents(int events)
+{
+    return ((events & IO_READ) ? EPOLLIN : 0) | ((events & IO_WRITE) ? EPOLLOUT : 0);
+}
+
+#endif
+
+/* PollWait - wait on descriptors with poll; returns the ready events of the first ready one */
+static int PollWait(const int *fds, const int *events, int count, int timeout, int *pFd)
+{
+    struct pollfd pfds[IOREADY_MAX_FDS];
+    int sts, i;
+
+    for (i = 0; i < count; ++i) {
+        pfds[i].fd = fds[i];
+        pfds[i].events = ((events[i] & IO_READ) ? POLLIN : 0) | ((events[i] & IO_WRITE) ? POLLOUT : 0);
+        pfds[i].revents = 0;
+    }
+
+    while ((sts = poll(pfds, count, timeout)) < 0 && errno == EINTR)
+        ;
+    if (sts <= 0)
+        return sts;
+
+    for (i = 0; i < count; ++i) {
+        if (pfds[i].revents) {
+            if (pFd)
+                *pFd = pfds[i].fd;
+            /* errors and hangups are reported as the events waited for so the next read or write sees them */
+            if (pfds[i].revents & (POLLERR | POLLHUP | POLLNVAL))
+                return events[i];
+            return ((pfds[i].revents & POLLIN) ? IO_READ : 0) | ((pfds[i].revents & POLLOUT) ? IO_WRITE : 0);
+        }
+    }
+
+    return 0;
+}
+
+/* IoReadyCreate - create an empty set */
+IoReadySet *IoReadyCreate(void)
+{
+    IoReadySet *set;
+
+    if (!(set = (IoReadySet *)malloc(sizeof(IoReadySet))))
+        return NULL;
+    memset(set, 0, sizeof(IoReadySet));
+
+#ifdef LINUX
+    if ((set->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        free(set);
+        return NULL;
+    }
+#endif
+
+    return set;
+}
+
+/* IoReadyDestroy - destroy a set (the descriptors in it are left open) */
+void IoReadyDestroy(IoReadySet *set)
+{
+    if (set) {
+#ifdef LINUX
+        close(set->epfd);
+#endif
+        free(set);
+    }
+}
+
+/* IoReadyAdd - add a descriptor to a set or change the events waited for on one that is already in it */
+int IoReadyAdd(IoReadySet *set, int fd, int events)
+{
+    int i;
+
+    for (i = 0; i < set->count; ++i) {
+        if (set->fds[i] == fd)
+            break;
+    }
+    if (i >= IOREADY_MAX_FDS)
+        return -1;
+
+#ifdef LINUX
+    {
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EpollEvents(events);
+        event.data.fd = fd;
+        if (!set->polled && epoll_ctl(set->epfd, i < set->count ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &event) != 0) {
+            if (errno != EPERM)
+                return -1;
+            set->polled = 1;
+        }
+    }
+#endif
+
+    set->fds[i] = fd;
+    set->events[i] = events;
+    if (i == set->count)
+        ++set->count;
+    return 0;
+}
+
+/* IoReadyWaitSet - wait up to timeout milliseconds (forever if negative) for a descriptor in a set to be ready
+
+   returns the events that are ready on one descriptor (stored in *pFd), 0 on a timeout or -1 on an error
+*/
+int IoReadyWaitSet(IoReadySet *set, int timeout, int *pFd)
+{
+#ifdef LINUX
+    struct epoll_event event;
+    int sts, i;
+
+    if (set->polled)
+        return PollWait(set->fds, set->events, set->count, timeout, pFd);
+
+    while ((sts = epoll_wait(set->epfd, &event, 1, timeout)) < 0 && errno == EINTR)
+        ;
+    if (sts <= 0)
+        return sts;
+
+    if (pFd)
+        *pFd = event.data.fd;
+    if (event.events & (EPOLLERR | EPOLLHUP)) {
+        for (i = 0; i < set->count; ++i) {
+            if (set->fds[i] == event.data.fd)
+                return set->events[i];
+        }
+    }
+    return ((event.events & EPOLLIN) ? IO_READ : 0) | ((event.events & EPOLLOUT) ? IO_WRITE : 0);
+#else
+    return PollWait(set->fds, set->events, set->count, timeout, pFd);
+#endif
+}
+
+/* IoReadyRegister - give a descriptor its own set so waiting on it doesn't need any setup */
+int IoReadyRegister(int fd)
+{
+    IoReadySet *set, **newRegistered;
+    int newMax;
+
+    if (fd < 0 || !(set = IoReadyCreate()))
+        return -1;
+    if (IoReadyAdd(set, fd, IO_READ) != 0) {
+        IoReadyDestroy(set);
+        return -1;
+    }
+
+    pthread_mutex_lock(&registeredLock);
+    if (fd >= registeredMax) {
+        newMax = registeredMax ? registeredMax : 64;
+        while (newMax <= fd)
+            newMax *= 2;
+        if (!(newRegistered = (IoReadySet **)realloc(registered, newMax * sizeof(IoReadySet *)))) {
+            pthread_mutex_unlock(&registeredLock);
+            IoReadyDestroy(set);
+            return -1;
+        }
+        memset(&newRegistered[registeredMax], 0, (newMax - registeredMax) * sizeof(IoReadySet *));
+        registered = newRegistered;
+        registeredMax = newMax;
+    }
+    IoReadyDestroy(registered[fd]);
+    registered[fd] = set;
+    pthread_mutex_unlock(&registeredLock);
+
+    return 0;
+}
+
+/* IoReadyUnregister - forget a registered descriptor (call before closing it) */
+void IoReadyUnregister(int fd)
+{
+    IoReadySet *set = NULL;
+
+    pthread_mutex_lock(&registeredLock);
+    if (fd >= 0 && fd < registeredMax) {
+        set = registered[fd];
+        registered[fd] = NULL;
+    }
+    pthread_mutex_unlock(&registeredLock);
+
+    IoReadyDestroy(set);
+}
+
+/* IoReadyWait - wait up to timeout milliseconds (forever if negative) for a descriptor to be ready
+
+   returns the events that are ready, 0 on a timeout or -1 on an error
+*/
+int IoReadyWait(int fd, int events, int timeout)
+{
+    IoReadySet *set = NULL;
+
+    pthread_mutex_lock(&registeredLock);
+    if (fd >= 0 && fd < registeredMax)
+        set = registered[fd];
+    pthread_mutex_unlock(&registeredLock);
+
+    /* descriptors that aren't registered are polled */
+    if (!set)
+        return PollWait(&fd, &events, 1, timeout, NULL);
+
+    if (set->events[0] != events && IoReadyAdd(set, fd, events) != 0)
+        return -1;
+    return IoReadyWaitSet(set, timeout, NULL);
+}
@@ -0,0 +1,29 @@
+#ifndef __IOREADY_H__
+#define __IOREADY_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* readiness events */
+#define IO_READ     1
+#define IO_WRITE    2
+
+/* a set of descriptors registered once and then waited on together (epoll on Linux, poll elsewhere) */
+typedef struct IoReadySet IoReadySet;
+
+IoReadySet *IoReadyCreate(void);
+void IoReadyDestroy(IoReadySet *set);
+int IoReadyAdd(IoReadySet *set, int fd, int events);
+int IoReadyWaitSet(IoReadySet *set, int timeout, int *pFd);
+
+/* single descriptors; waiting on one that isn't registered works but sets it up each time */
+int IoReadyRegister(int fd);
+void IoReadyUnregister(int fd);
+int IoReadyWait(int fd, int events, int timeout);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
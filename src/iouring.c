@@ -0,0 +1,374 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "iouring.h"
+#include "proploader.h"
+
+/* submission queue entries (each read with a timeout takes two) */
+#define IOURING_ENTRIES     64
+
+/* most buffers IoUringWriteV can write at once */
+#define IOURING_MAX_IOV     16
+
+/* an operation a thread is waiting for */
+typedef struct UringOp UringOp;
+struct UringOp {
+    int done;
+    int res;
+    pthread_cond_t wake;
+    UringOp *next;      /* next operation whose thread is waiting for another thread to reap */
+};
+
+static struct {
+    pthread_mutex_t lock;
+    int enabled;
+    int fd;
+    void *sqRing, *cqRing;
+    size_t sqRingSize, cqRingSize, sqesSize;
+    struct io_uring_sqe *sqes;
+    unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+    unsigned *cqHead, *cqTail, *cqMask;
+    struct io_uring_cqe *cqes;
+    unsigned queued;    /* entries added to the submission queue but not passed to the kernel yet */
+    int reaping;        /* a thread is waiting in the kernel for completions */
+    UringOp *waiting;   /* operations whose threads are waiting for that thread */
+} ring = { .lock = PTHREAD_MUTEX_INITIALIZER, .fd = -1 };
+
+/* Release - unmap whatever Setup mapped and close the ring (called with the lock held) */
+static void Release(void)
+{
+    if (ring.sqes != MAP_FAILED)
+        munmap(ring.sqes, ring.sqesSize);
+    if (ring.cqRing != MAP_FAILED && ring.cqRing != ring.sqRing)
+        munmap(ring.cqRing, ring.cqRingSize);
+    if (ring.sqRing != MAP_FAILED)
+        munmap(ring.sqRing, ring.sqRingSize);
+    ring.sqRing = ring.cqRing = MAP_FAILED;
+    ring.sqes = (struct io_uring_sqe *)MAP_FAILED;
+    close(ring.fd);
+    ring.fd = -1;
+}
+
+static int Setup(void)
+{
+    struct io_uring_params params;
+
+    ring.sqRing = ring.cqRing = MAP_FAILED;
+    ring.sqes = (struct io_uring_sqe *)MAP_FAILED;
+
+    memset(&params, 0, sizeof(params));
+    if ((ring.fd = (int)syscall(__NR_io_uring_setup, IOURING_ENTRIES, &params)) < 0)
+        return -1;
+
+    /* reads of serial ports must wait for data by polling rather than on a kernel worker thread */
+    if (!(params.features & IORING_FEAT_FAST_POLL)) {
+        Release();
+        return -1;
+    }
+
+    ring.sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring.cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring.cqRingSize > ring.sqRingSize)
+            ring.sqRingSize = ring.cqRingSize;
+        ring.cqRingSize = ring.sqRingSize;
+    }
+
+    ring.sqRing = mmap(NULL, ring.sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING);
+    if (ring.sqRing == MAP_FAILED)
+        goto fail;
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        ring.cqRing = ring.sqRing;
+    else {
+        ring.cqRing = mmap(NULL, ring.cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_CQ_RING);
+        if (ring.cqRing == MAP_FAILED)
+            goto fail;
+    }
+    ring.sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring.sqes = (struct io_uring_sqe *)mmap(NULL, ring.sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+    if (ring.sqes == MAP_FAILED)
+        goto fail;
+
+    ring.sqHead = (unsigned *)((char *)ring.sqRing + params.sq_off.head);
+    ring.sqTail = (unsigned *)((char *)ring.sqRing + params.sq_off.tail);
+    ring.sqMask = (unsigned *)((char *)ring.sqRing + params.sq_off.ring_mask);
+    ring.sqArray = (unsigned *)((char *)ring.sqRing + params.sq_off.array);
+    ring.cqHead = (unsigned *)((char *)ring.cqRing + params.cq_off.head);
+    ring.cqTail = (unsigned *)((char *)ring.cqRing + params.cq_off.tail);
+    ring.cqMask = (unsigned *)((char *)ring.cqRing + params.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe *)((char *)ring.cqRing + params.cq_off.cqes);
+
+    return 0;
+
+fail:
+    Release();
+    return -1;
+}
+
+/* IoUringEnable - start or stop using io_uring for transfers; returns -1 if the kernel doesn't support it
+
+   Stopping keeps the ring (operations already submitted may still be completing on it) so starting again is cheap; it
+   goes away with the process.
+*/
+int IoUringEnable(int enable)
+{
+    int sts = 0;
+
+    pthread_mutex_lock(&ring.lock);
+    if (enable && ring.fd < 0)
+        sts = Setup();
+    __atomic_store_n(&ring.enabled, enable && sts == 0, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&ring.lock);
+
+    return sts;
+}
+
+int IoUringEnabled(void)
+{
+    return __atomic_load_n(&ring.enabled, __ATOMIC_ACQUIRE);
+}
+
+/* Drop - take back the entries the kernel hasn't seen and fail their operations (called with the lock held) */
+static void Drop(void)
+{
+    unsigned tail = *ring.sqTail;
+
+    for (; ring.queued > 0; --ring.queued) {
+        struct io_uring_sqe *sqe = &ring.sqes[--tail & *ring.sqMask];
+        UringOp *op = (UringOp *)(uintptr_t)sqe->user_data;
+        if (op) {
+            op->res = -ECANCELED;
+            op->done = 1;
+            pthread_cond_signal(&op->wake);
+        }
+    }
+
+    __atomic_store_n(ring.sqTail, tail, __ATOMIC_RELEASE);
+}
+
+/* Submit - pass the queued entries to the kernel (called with the lock held)
+
+   If the kernel won't take them, they are dropped and the ring is disabled so later transfers block as usual.
+   Operations the kernel already has are unaffected and still complete through the ring.
+*/
+static int Submit(void)
+{
+    int cnt;
+
+    while (ring.queued > 0) {
+        if ((cnt = (int)syscall(__NR_io_uring_enter, ring.fd, ring.queued, 0, 0, NULL, 0)) < 0) {
+            if (errno == EINTR)
+                continue;
+            __atomic_store_n(&ring.enabled, 0, __ATOMIC_RELEASE);
+            Drop();
+            return -1;
+        }
+        ring.queued -= cnt;
+    }
+
+    return 0;
+}
+
+/* Reserve - make room for count entries by submitting what is already queued (called with the lock held) */
+static int Reserve(unsigned count)
+{
+    if (*ring.sqTail - __atomic_load_n(ring.sqHead, __ATOMIC_ACQUIRE) + count > *ring.sqMask + 1)
+        return Submit();
+    return 0;
+}
+
+/* GetEntry - get a cleared submission queue entry after reserving room for it (called with the lock held) */
+static struct io_uring_sqe *GetEntry(void)
+{
+    unsigned tail = *ring.sqTail, index;
+    struct io_uring_sqe *sqe;
+
+    index = tail & *ring.sqMask;
+    sqe = &ring.sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring.sqArray[index] = index;
+    __atomic_store_n(ring.sqTail, tail + 1, __ATOMIC_RELEASE);
+    ++ring.queued;
+
+    return sqe;
+}
+
+/* Reap - hand completions to the operations waiting for them (called with the lock held) */
+static void Reap(void)
+{
+    unsigned head = *ring.cqHead;
+
+    while (head != __atomic_load_n(ring.cqTail, __ATOMIC_ACQUIRE)) {
+        struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cqMask];
+        UringOp *op = (UringOp *)(uintptr_t)cqe->user_data;
+
+        /* timeouts linked to reads have no operation */
+        if (op) {
+            op->res = cqe->res;
+            op->done = 1;
+            pthread_cond_signal(&op->wake);
+        }
+        ++head;
+    }
+
+    __atomic_store_n(ring.cqHead, head, __ATOMIC_RELEASE);
+}
+
+/* Complete - submit everything queued and wait for an operation to finish (called with the lock held) */
+static int Complete(UringOp *op)
+{
+    UringOp **pNext;
+    int sts, err;
+
+    while (!op->done) {
+
+        /* submit our entries along with any other thread's (a failed submission fails them) */
+        if (Submit() != 0 && op->done)
+            break;
+
+        /* let the thread already waiting in the kernel reap our completion for us */
+        if (ring.reaping) {
+            op->next = ring.waiting;
+            ring.waiting = op;
+            pthread_cond_wait(&op->wake, &ring.lock);
+            for (pNext = &ring.waiting; *pNext != op; pNext = &(*pNext)->next)
+                ;
+            *pNext = op->next;
+        }
+
+        else {
+            ring.reaping = 1;
+            pthread_mutex_unlock(&ring.lock);
+            sts = (int)syscall(__NR_io_uring_enter, ring.fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+            err = errno;
+            pthread_mutex_lock(&ring.lock);
+            ring.reaping = 0;
+            Reap();
+            if (sts < 0 && err != EINTR && err != EAGAIN && err != EBUSY) {
+                /* the kernel still owns the buffers of the operations in flight, some of them on their threads'
+                   stacks, so there is no safe way to give up on them */
+                message("io_uring wait failed -- %s", strerror(err));
+                abort();
+            }
+        }
+    }
+
+    /* wake a waiting thread to take over reaping */
+    if (!ring.reaping && ring.waiting)
+        pthread_cond_signal(&ring.waiting->wake);
+
+    return op->res;
+}
+
+/* IoUringWrite - write all of a buffer */
+int IoUringWrite(int fd, const void *buf, int len)
+{
+    struct iovec iov;
+    iov.iov_base = (void *)buf;
+    iov.iov_len = len;
+    return IoUringWriteV(fd, &iov, 1);
+}
+
+/* IoUringWriteV - write all of a scatter-gather list */
+int IoUringWriteV(int fd, const struct iovec *iov, int count)
+{
+    struct iovec remaining[IOURING_MAX_IOV];
+    struct io_uring_sqe *sqe;
+    struct iovec *next = remaining;
+    UringOp op;
+    int len = 0, cnt, i;
+
+    if (count > IOURING_MAX_IOV)
+        return -1;
+    for (i = 0; i < count; ++i) {
+        remaining[i] = iov[i];
+        len += (int)iov[i].iov_len;
+    }
+
+    pthread_cond_init(&op.wake, NULL);
+    pthread_mutex_lock(&ring.lock);
+
+    while (count > 0) {
+        if (Reserve(1) != 0)
+            break;
+        sqe = GetEntry();
+        sqe->opcode = IORING_OP_WRITEV;
+        sqe->fd = fd;
+        sqe->addr = (uintptr_t)next;
+        sqe->len = count;
+        sqe->off = (uint64_t)-1;
+        sqe->user_data = (uintptr_t)&op;
+        op.done = 0;
+        if ((cnt = Complete(&op)) <= 0)
+            break;
+
+        /* step past what was written */
+        while (count > 0 && (size_t)cnt >= next->iov_len) {
+            cnt -= (int)next->iov_len;
+            ++next;
+            --count;
+        }
+        if (count > 0) {
+            next->iov_base = (uint8_t *)next->iov_base + cnt;
+            next->iov_len -= cnt;
+        }
+    }
+
+    pthread_mutex_unlock(&ring.lock);
+    pthread_cond_destroy(&op.wake);
+
+    return count == 0 ? len : -1;
+}
+
+/* IoUringRead - read whatever is available when something is, giving up after timeout milliseconds */
+int IoUringRead(int fd, void *buf, int len, int timeout)
+{
+    struct __kernel_timespec ts;
+    struct io_uring_sqe *sqe;
+    UringOp op;
+    int cnt;
+
+    pthread_cond_init(&op.wake, NULL);
+    pthread_mutex_lock(&ring.lock);
+
+    /* the read and its timeout must be submitted together */
+    if (Reserve(timeout >= 0 ? 2 : 1) != 0) {
+        pthread_mutex_unlock(&ring.lock);
+        pthread_cond_destroy(&op.wake);
+        return -1;
+    }
+    sqe = GetEntry();
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (uintptr_t)buf;
+    sqe->len = len;
+    sqe->off = (uint64_t)-1;
+    sqe->user_data = (uintptr_t)&op;
+    op.done = 0;
+
+    /* cancel the read if the timeout expires first (the read then completes with -ECANCELED) */
+    if (timeout >= 0) {
+        sqe->flags |= IOSQE_IO_LINK;
+        sqe = GetEntry();
+        ts.tv_sec = timeout / 1000;
+        ts.tv_nsec = (timeout % 1000) * 1000000LL;
+        sqe->opcode = IORING_OP_LINK_TIMEOUT;
+        sqe->addr = (uintptr_t)&ts;
+        sqe->len = 1;
+    }
+
+    cnt = Complete(&op);
+
+    pthread_mutex_unlock(&ring.lock);
+    pthread_cond_destroy(&op.wake);
+
+    return cnt >= 0 ? cnt : -1;
+}
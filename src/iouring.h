@@ -0,0 +1,27 @@
+#ifndef __IOURING_H__
+#define __IOURING_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct iovec;
+
+/* route serial port and socket transfers through one io_uring shared by every open connection (Linux only)
+
+   submissions queued by different threads go to the kernel together the next time any of them has to wait
+*/
+int IoUringEnable(int enable);
+int IoUringEnabled(void);
+
+/* these return the number of bytes transferred (0 at the end of a connection) or -1 on an error or a timeout
+   (a negative timeout waits forever) */
+int IoUringWrite(int fd, const void *buf, int len);
+int IoUringWriteV(int fd, const struct iovec *iov, int count);
+int IoUringRead(int fd, void *buf, int len, int timeout);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
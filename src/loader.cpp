@@ -5,6 +5,7 @@
 #include <unistd.h>
 #include "loader.h"
 #include "loadelf.h"
+#include "loadtrace.h"
 #include "propimage.h"
 #include "proploader.h"
 
@@ -48,7 +49,10 @@ int Loader::loadImage(const uint8_t *image, int imageSize, LoadType loadType)
     }
         
     nmessage(INFO_DOWNLOADING, m_connection->portName());
-    return m_connection->loadImage(image, imageSize, loadType);
+    LoadTraceBegin(GetConfigField(m_connection->config(), "load-trace"), "rom", m_connection->portName(), m_connection->receiveLatency());
+    int sts = m_connection->loadImage(image, imageSize, loadType);
+    LoadTraceEnd(sts);
+    return sts;
 }
 
 uint8_t *Loader::readFile(const char *file, int *pImageSize)
@@ -3,9 +3,25 @@
 
 #include <stdint.h>
 #include <unistd.h>
+#include <pthread.h>
 #include "propconnection.h"
 #include "loadelf.h"
 
+// predicted cost of loading an image with each loader (times are in milliseconds)
+struct LoadPlan {
+    int romTime;                // time to load with the ROM loader or -1 if the connection can't
+    int romLoadSize;            // bytes sent to the ROM boot loader
+    int loaderBaudRate;         // baud rate of the ROM boot loader
+    int fastTime;               // time to load with the fast loader
+    int secondStageLoadSize;    // bytes sent to the ROM boot loader to start the second-stage loader
+    int fastDataSize;           // bytes of image (or compressed stream) sent in packets
+    bool compressed;            // true if the fast loader would send a compressed stream
+    int packetCount;
+    int packetDataSize;
+    int fastLoaderBaudRate;
+    bool useFastLoader;         // true if the fast loader is predicted to be faster
+};
+
 class Loader {
 public:
     Loader() : m_connection(0) {}
@@ -17,11 +33,37 @@ public:
     int fastLoadFile(const char *file, LoadType loadType = ltDownloadAndRun);
     int loadImage(const uint8_t *image, int imageSize, LoadType loadType = ltDownloadAndRun);
     int fastLoadImage(const uint8_t *image, int imageSize, LoadType loadType = ltDownloadAndRun);
+    int planLoad(const uint8_t *image, int imageSize, LoadType loadType, LoadPlan *plan);
     static uint8_t *readFile(const char *file, int *pImageSize);
 private:
-    int fastLoadImageHelper(const uint8_t *image, int imageSize, LoadType loadType, int clockSpeed, int clockMode, int loaderBaudRate, int fastLoaderBaudRate);
-    uint8_t *generateInitialLoaderImage(int clockSpeed, int clockMode, int packetID, int loaderBaudRate, int fastLoaderBaudRate, int *pLength);
-    int transmitPacket(int id, const uint8_t *payload, int payloadSize, int *pResult, int timeout = 2000);
+    // image preparation done on a worker thread while the second-stage loader is delivered
+    struct ImagePrep {
+        const uint8_t *image;   // image with its clock settings patched
+        int imageSize;          // size up to vbase
+        bool compress;          // true to compress the image
+        uint8_t *stream;        // compressed image or NULL if it doesn't compress
+        int streamSize;
+        int32_t checksum;       // checksum of the image and the initial call frame
+        pthread_t thread;
+        bool threaded;          // true if the worker thread was started
+        bool pending;           // true until the results have been collected
+    };
+    static void *prepareImage(void *data);
+    static void finishImagePrep(ImagePrep *prep);
+    static uint8_t *compressImage(const uint8_t *image, int imageSize, int *pStreamSize);
+    int autoFastLoaderBaudRate(int clockSpeed, bool windowed);
+    int lowerFastLoaderBaudRate(int baudRate);
+    int higherFastLoaderBaudRate(int baudRate);
+    int fastLoadImageHelper(const uint8_t *image, int imageSize, ImagePrep *prep, LoadType loadType, int clockSpeed, int clockMode, int loaderBaudRate, int *pFastLoaderBaudRate);
+    uint8_t *generateInitialLoaderImage(int clockSpeed, int clockMode, int packetID, int packetDataSize, int loaderBaudRate, int fastLoaderBaudRate, int *pLength);
+    int transmitPacket(int id, const uint8_t *payload, int payloadSize, int *pResult, int timeout = 0);
+    int64_t wireTime(int byteCount);
+    int retransmitTimeout(int byteCount, int backoff = 1);
+    void addRoundTripSample(int64_t sendTime, int64_t now, int byteCount);
+    int stepDownBaudRate(int clockSpeed, int *pBaudRate, int32_t *pPacketID);
+    int maxPacketDataSize();
+    int transmitWindow(const uint8_t *image, int imageSize, int packetDataSize, int window);
+    int sendWindowPacket(int id, int32_t tag, const uint8_t *image, int offset, int size, int64_t *pLineFree);
     static uint8_t *readSpinBinaryFile(FILE *fp, int *pImageSize);
     static uint8_t *readElfFile(FILE *fp, ElfHdr *hdr, int *pImageSize);
     PropConnection *m_connection;
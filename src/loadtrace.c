@@ -0,0 +1,162 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "loadtrace.h"
+#include "system.h"
+
+#define MAXNAME     256
+
+typedef struct {
+    const char *phase;      /* phase name or NULL for a packet */
+    int64_t start;          /* microseconds from the start of the load */
+    int64_t elapsed;        /* microseconds the phase took or the packet's round trip time */
+    int id;                 /* packet ID */
+    int bytes;              /* bytes sent */
+    int transmissions;      /* number of times the packet was sent */
+    int baudRate;           /* baud rate in use */
+} LoadTraceEntry;
+
+static int active = FALSE;
+static char tracePath[PATH_MAX];
+static char traceLoader[MAXNAME];
+static char tracePort[MAXNAME];
+static int traceLatency;
+static int64_t traceStart;
+static LoadTraceEntry *entries = NULL;
+static int entryCount = 0;
+static int entryMax = 0;
+
+/* AddEntry - add an entry to the trace or return NULL if not tracing or out of memory */
+static LoadTraceEntry *AddEntry(int64_t startTime)
+{
+    LoadTraceEntry *newEntries, *entry;
+    if (!active)
+        return NULL;
+    if (entryCount >= entryMax) {
+        int newMax = entryMax ? entryMax * 2 : 64;
+        if (!(newEntries = realloc(entries, newMax * sizeof(LoadTraceEntry))))
+            return NULL;
+        entries = newEntries;
+        entryMax = newMax;
+    }
+    entry = &entries[entryCount++];
+    memset(entry, 0, sizeof(LoadTraceEntry));
+    entry->start = startTime - traceStart;
+    return entry;
+}
+
+/* WriteString - write a string as a JSON string */
+static void WriteString(FILE *fp, const char *str)
+{
+    putc('"', fp);
+    for (; *str; ++str) {
+        if (*str == '"' || *str == '\\')
+            fprintf(fp, "\\%c", *str);
+        else if ((unsigned char)*str < ' ')
+            fprintf(fp, "\\u%04x", (unsigned char)*str);
+        else
+            putc(*str, fp);
+    }
+    putc('"', fp);
+}
+
+/* LoadTraceBegin - start tracing a load to path discarding any previous trace; a NULL path turns tracing off */
+void LoadTraceBegin(const char *path, const char *loader, const char *port, int latency)
+{
+    if (!(active = path != NULL))
+        return;
+    strncpy(tracePath, path, sizeof(tracePath) - 1);
+    strncpy(traceLoader, loader, sizeof(traceLoader) - 1);
+    strncpy(tracePort, port ? port : "", sizeof(tracePort) - 1);
+    traceLatency = latency;
+    traceStart = xbMonotonicMicros();
+    entryCount = 0;
+}
+
+/* LoadTraceTime - get the start time of a phase or packet; the clock is only read when tracing */
+int64_t LoadTraceTime(void)
+{
+    return active ? xbMonotonicMicros() : 0;
+}
+
+/* LoadTracePhase - record a phase that began at startTime and has just ended */
+void LoadTracePhase(const char *phase, int64_t startTime, int bytes, int baudRate)
+{
+    LoadTraceEntry *entry;
+    if ((entry = AddEntry(startTime)) != NULL) {
+        entry->phase = phase;
+        entry->elapsed = xbMonotonicMicros() - startTime;
+        entry->bytes = bytes;
+        entry->baudRate = baudRate;
+    }
+}
+
+/* LoadTracePacket - record a packet whose first transmission began at startTime */
+void LoadTracePacket(int id, int64_t startTime, int bytes, int transmissions, int64_t rtt, int baudRate)
+{
+    LoadTraceEntry *entry;
+    if ((entry = AddEntry(startTime)) != NULL) {
+        entry->id = id;
+        entry->elapsed = rtt;
+        entry->bytes = bytes;
+        entry->transmissions = transmissions;
+        entry->baudRate = baudRate;
+    }
+}
+
+/* LoadTraceEnd - stop tracing and append the trace as a line of JSON to the file given to LoadTraceBegin ("-" for stderr)
+
+    {"loader":"fast","port":"...","latency_ms":n,"status":0,"elapsed_us":n,
+     "phases":[{"phase":"reset","start_us":n,"elapsed_us":n,"bytes":n,"baud":n},...],
+     "packets":[{"id":n,"start_us":n,"rtt_us":n,"bytes":n,"transmissions":n,"baud":n},...]}
+*/
+int LoadTraceEnd(int status)
+{
+    LoadTraceEntry *entry;
+    int64_t elapsed;
+    int first, i;
+    FILE *fp;
+
+    if (!active)
+        return FALSE;
+    active = FALSE;
+    elapsed = xbMonotonicMicros() - traceStart;
+
+    if (strcmp(tracePath, "-") == 0)
+        fp = stderr;
+    else if (!(fp = fopen(tracePath, "a")))
+        return FALSE;
+
+    fprintf(fp, "{\"loader\":");
+    WriteString(fp, traceLoader);
+    fprintf(fp, ",\"port\":");
+    WriteString(fp, tracePort);
+    fprintf(fp, ",\"latency_ms\":%d", traceLatency);
+    fprintf(fp, ",\"status\":%d,\"elapsed_us\":%lld,\"phases\":[", status, (long long)elapsed);
+    for (i = 0, first = TRUE; i < entryCount; ++i) {
+        entry = &entries[i];
+        if (!entry->phase)
+            continue;
+        fprintf(fp, "%s{\"phase\":", first ? "" : ",");
+        WriteString(fp, entry->phase);
+        fprintf(fp, ",\"start_us\":%lld,\"elapsed_us\":%lld,\"bytes\":%d,\"baud\":%d}",
+                (long long)entry->start, (long long)entry->elapsed, entry->bytes, entry->baudRate);
+        first = FALSE;
+    }
+    fprintf(fp, "],\"packets\":[");
+    for (i = 0, first = TRUE; i < entryCount; ++i) {
+        entry = &entries[i];
+        if (entry->phase)
+            continue;
+        fprintf(fp, "%s{\"id\":%d,\"start_us\":%lld,\"rtt_us\":%lld,\"bytes\":%d,\"transmissions\":%d,\"baud\":%d}",
+                first ? "" : ",", entry->id, (long long)entry->start, (long long)entry->elapsed,
+                entry->bytes, entry->transmissions, entry->baudRate);
+        first = FALSE;
+    }
+    fprintf(fp, "]}\n");
+
+    if (fp != stderr)
+        fclose(fp);
+    return TRUE;
+}
@@ -0,0 +1,23 @@
+#ifndef __LOADTRACE_H__
+#define __LOADTRACE_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* times are from xbMonotonicMicros(); a packet's rtt runs from when its last transmission should have finished going out
+   to its response arriving and is -1 if no response was waited for or none arrived; latency is the connection's
+   receive latency in milliseconds or -1 if it isn't known; nothing is recorded unless LoadTraceBegin is given a path */
+void LoadTraceBegin(const char *path, const char *loader, const char *port, int latency);
+int64_t LoadTraceTime(void);
+void LoadTracePhase(const char *phase, int64_t startTime, int bytes, int baudRate);
+void LoadTracePacket(int id, int64_t startTime, int bytes, int transmissions, int64_t rtt, int baudRate);
+int LoadTraceEnd(int status);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -16,6 +16,9 @@
 #include "wifipropconnection.h"
 #include "wifiprop2connection.h"
 #include "config.h"
+#ifdef LINUX
+#include "iouring.h"
+#endif
 
 /* default port name prefix if only a partial name is specified */
 #if defined(CYGWIN) || defined(WIN32) || defined(MINGW)
@@ -42,6 +45,8 @@ usage: %s [options] [<file>]\n\
 options:\n\
     -b <type>       select target board and subtype (default is 'default:default')\n\
     -c              display numeric message codes\n\
+    -C              find the shortest reset timing that works with the board and exit\n\
+    -d              show the predicted load time with each loader and exit\n\
     -D var=value    define a board configuration variable\n\
     -e              program eeprom (and halt, unless combined with -r)\n\
     -f <file>       write a file to the SD card\n\
@@ -70,8 +75,10 @@ end with a '-'. They must also be less than 32 characters long.\n\
 Variables that can be set with -D are:\n\
 \n\
 Used by the loader:\n\
-  loader reset clkfreq clkmode fast-loader-clkfreq fast-loader-clkmode\n\
-  baud-rate loader-baud-rate fast-loader-baud-rate chipver\n\
+  loader reset reset-pulse-time reset-settle-time clkfreq clkmode fast-loader-clkfreq fast-loader-clkmode\n\
+  baud-rate loader-baud-rate fast-loader-baud-rate fast-loader-window fast-loader-compress\n\
+  fast-loader-packet-size baud-cache load-trace serial-reader-thread io-uring chipver\n\
+  tcp-nodelay tcp-quickack tcp-send-buffer tcp-receive-buffer tcp-keepalive\n\
 \n\
 Used by the SD file writer:\n\
   sdspi-do sdspi-clk sdspi-di sdspi-cs\n\
@@ -84,7 +91,8 @@ Value expressions for -D can include:\n\
   or a parenthesized expression.\n\
 \n\
 Examples:\n\
-  loader=rom  to use the ROM loader instead of the fast loader\n",
+  loader=rom  to use the ROM loader instead of the fast loader\n\
+  loader=auto to use whichever loader is predicted to be faster for the image\n",
            VERSION, progname);
     exit(1);
 }
@@ -98,6 +106,9 @@ int main(int argc, char *argv[])
 {
     BoardConfig *config, *configSettings;
     bool useFastLoader = true;
+    bool planLoader = false;
+    bool dryRun = false;
+    bool calibrate = false;
     bool done = false;
     bool reset = false;
     bool showPorts = false;
@@ -147,6 +158,13 @@ int main(int argc, char *argv[])
             case 'c': // display numeric message codes
                 showMessageCodes = true;
                 break;
+            case 'C': // calibrate the reset timing
+                calibrate = true;
+                useSerial = true;
+                break;
+            case 'd': // predict the load time with each loader without loading
+                dryRun = true;
+                break;
             case 'D':
                 if (argv[i][2])
                     p = &argv[i][2];
@@ -394,6 +412,11 @@ int main(int argc, char *argv[])
     /* override with any command line settings */
     config = MergeConfigs(config, configSettings);
 
+    /* remember the board type for the fast loader baud rate cache */
+    char boardType[sizeof(boardBuffer) * 2];
+    snprintf(boardType, sizeof(boardType), "%s:%s", board, subtype);
+    SetConfigField(configSettings, "board-type", boardType);
+
     /* set programming style based on chip version */
     if ((p = GetConfigField(config, "chipver")) != NULL && strcmp(p, "P2") == 0)
     {
@@ -405,19 +428,61 @@ int main(int argc, char *argv[])
     /* decide whether to use the fast or rom loader */
     if ((p = GetConfigField(config, "loader")) != NULL && strcmp(p, "rom") == 0)
         useFastLoader = false;
+    else if (p && strcmp(p, "auto") == 0)
+        planLoader = useFastLoader;
+
+#ifdef LINUX
+    /* do serial port and socket transfers through io_uring */
+    if (GetNumericConfigField(config, "io-uring", &i) && i)
+    {
+        if (IoUringEnable(1) != 0)
+            message("Can't use io_uring - using blocking transfers");
+    }
+#endif
 
     /* make sure a file to load was specified */
-    if (!done && !reset && !file && !terminalMode)
+    if (!done && !reset && !calibrate && !file && !terminalMode)
         usage(argv[0]);
 
     /* check to there is anything more to do */
-    if (!reset && !file && !name && !terminalMode)
+    if (!reset && !calibrate && !file && !name && !terminalMode)
         goto finish;
 
     /* default to 'download and run' if neither -e nor -r are specified */
     if (loadType == ltShutdown)
         loadType = ltDownloadAndRun;
 
+    /* predict the time each loader would take without touching the hardware */
+    if (dryRun)
+    {
+        LoadPlan plan;
+        if (!file || chipVerP2)
+            usage(argv[0]);
+        if (useSerial)
+            connection = serialConnection = new SerialPropConnection;
+        else
+            connection = wifiConnection = new WiFiPropConnection;
+        if (!connection)
+        {
+            nmessage(ERROR_INSUFFICIENT_MEMORY);
+            return 1;
+        }
+        connection->setConfig(config);
+        loader.setConnection(connection);
+        if (loader.planLoad(image, imageSize, (LoadType)loadType, &plan) != 0)
+            return 1;
+        if (plan.romTime < 0)
+            printf("ROM loader:  not possible (the %s connection is limited to %d byte images)\n",
+                   useSerial ? "serial" : "Wi-Fi", connection->maxRomImageSize());
+        else
+            printf("ROM loader:  %d ms (%d bytes at %d baud)\n", plan.romTime, plan.romLoadSize, plan.loaderBaudRate);
+        printf("Fast loader: %d ms (%d bytes at %d baud, then %d %sbytes in %d packets at %d baud)\n",
+               plan.fastTime, plan.secondStageLoadSize, plan.loaderBaudRate, plan.fastDataSize,
+               plan.compressed ? "compressed " : "", plan.packetCount, plan.fastLoaderBaudRate);
+        printf("Faster:      %s loader\n", plan.useFastLoader ? "fast" : "ROM");
+        goto finish;
+    }
+
     /* do a serial download */
     // TODO: Implement P2 serial loader based on chipver value
     if (useSerial)
@@ -439,7 +504,12 @@ int main(int argc, char *argv[])
             if (!port)
             {
                 SerialInfoList ports;
-                if (SerialPropConnection::findPorts(true, ports) != 0)
+                int pulseTime, settleTime;
+                if (!GetNumericConfigField(config, "reset-pulse-time", &pulseTime))
+                    pulseTime = -1;
+                if (!GetNumericConfigField(config, "reset-settle-time", &settleTime))
+                    settleTime = -1;
+                if (SerialPropConnection::findPorts(true, ports, 1, GetConfigField(config, "reset"), pulseTime, settleTime) != 0)
                 {
                     nmessage(ERROR_SERIAL_PORT_DISCOVERY_FAILED);
                     return 1;
@@ -580,6 +650,39 @@ int main(int argc, char *argv[])
         }
     }
 
+    /* setup the reset timing */
+    if (serialConnection)
+    {
+        int pulseTime, settleTime;
+        if (!GetNumericConfigField(config, "reset-pulse-time", &pulseTime))
+            pulseTime = -1;
+        if (!GetNumericConfigField(config, "reset-settle-time", &settleTime))
+            settleTime = -1;
+        serialConnection->setResetTiming(pulseTime, settleTime);
+    }
+
+    /* read the serial port on a background thread */
+    if (serialConnection && GetNumericConfigField(config, "serial-reader-thread", &i) && i)
+    {
+        if (serialConnection->setReaderThread(true) != 0)
+            message("Can't start a serial reader thread - reading the port directly");
+    }
+
+    /* find the shortest reset timing that works with this board */
+    if (calibrate)
+    {
+        int pulseTime, settleTime;
+        if (serialConnection->calibrateReset(&pulseTime, &settleTime) != 0)
+        {
+            printf("error: failed to reset Propeller with the default timing\n");
+            return 1;
+        }
+        printf("# add these lines to the board configuration file or pass them with -D\n");
+        printf("reset-pulse-time: %d\n", pulseTime);
+        printf("reset-settle-time: %d\n", settleTime);
+        goto finish;
+    }
+
     /* reset the Propeller */
     if (reset)
     {
@@ -666,6 +769,15 @@ int main(int argc, char *argv[])
     else if (file)
     {
         loader.setConnection(connection);
+        if (planLoader)
+        {
+            LoadPlan plan;
+            if (loader.planLoad(image, imageSize, (LoadType)loadType, &plan) == 0 && !plan.useFastLoader)
+            {
+                message("Using the ROM loader - predicted %d ms against %d ms for the fast loader", plan.romTime, plan.fastTime);
+                useFastLoader = false;
+            }
+        }
         if (useFastLoader)
         {
             if ((sts = loader.fastLoadImage(image, imageSize, (LoadType)loadType)) != 0)
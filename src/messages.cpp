@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <ctype.h>
+#include <pthread.h>
 #include "messages.h"
 
 /*
@@ -99,6 +100,9 @@ static const char *messageText(int code)
 int verbose = 0;
 int showMessageCodes = false;
 
+// keeps the parts of a message together when threads (such as the port probes in findPorts) report at the same time
+static pthread_mutex_t messageLock = PTHREAD_MUTEX_INITIALIZER;
+
 int error(const char *fmt, ...)
 {
     va_list ap;
@@ -156,6 +160,7 @@ static void vmessage(const char *fmt, va_list ap, int eol)
 
     /* display messages in verbose mode or when the code is > 0 */
     if (verbose || code > 0) {
+        pthread_mutex_lock(&messageLock);
         if (showMessageCodes)
             printf("%03d-", code);
         if (code > 99)
@@ -164,6 +169,7 @@ static void vmessage(const char *fmt, va_list ap, int eol)
         putchar(eol);
         if (eol == '\r')
             fflush(stdout);
+        pthread_mutex_unlock(&messageLock);
     }
 }
 
@@ -171,6 +177,7 @@ static void vnmessage(int code, const char *fmt, va_list ap, int eol)
 {
     /* display messages in verbose mode or when the code is > 0 */
     if (verbose || code > 0) {
+        pthread_mutex_lock(&messageLock);
         if (showMessageCodes)
             printf("%03d-", code);
         if (code > 99)
@@ -179,5 +186,6 @@ static void vnmessage(int code, const char *fmt, va_list ap, int eol)
         putchar(eol);
         if (eol == '\r')
             fflush(stdout);
+        pthread_mutex_unlock(&messageLock);
     }
 }
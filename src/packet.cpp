@@ -98,6 +98,7 @@ int PacketDriver::waitForInitialAck(void)
 int PacketDriver::sendPacket(int type, uint8_t *buf, int len)
 {
     uint8_t hdr[PKTHDRLEN], crc[PKTCRCLEN], *p;
+    struct iovec frame[3];
     uint16_t crc16 = 0;
     int cnt, ch;
 
@@ -119,10 +120,13 @@ int PacketDriver::sendPacket(int type, uint8_t *buf, int len)
     crc[1] = (uint8_t)crc16;
 
     /* send the packet */
-    m_connection.sendData(hdr, PKTHDRLEN);
-    if (len > 0)
-        m_connection.sendData(buf, len);
-    m_connection.sendData(crc, PKTCRCLEN);
+    frame[0].iov_base = hdr;
+    frame[0].iov_len = PKTHDRLEN;
+    frame[1].iov_base = buf;
+    frame[1].iov_len = len;
+    frame[2].iov_base = crc;
+    frame[2].iov_len = PKTCRCLEN;
+    m_connection.sendDataV(frame, 3);
 
     /* wait for an ACK/NAK */
     if ((ch = waitForAckNak(PACKET_TIMEOUT)) < 0) {
@@ -0,0 +1,230 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "pdsencode.h"
+
+// Propeller Download Stream Translator array.  Index into this array using the "Binary Value" (usually 5 bits) to translate,
+// the incoming bit size (again, usually 5), and the desired data element to retrieve (encoding = translation, bitCount = bit count
+// actually translated.
+
+// first index is the next 1-5 bits from the incoming bit stream
+// second index is the number of bits in the first value
+// the result is a structure containing the byte to output to encode some or all of the input bits
+//
+// Each entry encodes as many of the bits as any byte can, and that greedy choice also gives the shortest stream.  Any
+// run of bits a byte encodes can also be encoded by a byte with some leading or trailing pulses dropped, so taking fewer
+// bits now never lets later bytes catch up.  tools/pdsbench.c checks this against a search for the optimal encoding.
+static const struct {
+    uint8_t encoding;   // encoded byte to output
+    uint8_t bitCount;   // number of bits encoded by the output byte
+} PDSTx[32][5] =
+
+//  ***  1-BIT  ***        ***  2-BIT  ***        ***  3-BIT  ***        ***  4-BIT  ***        ***  5-BIT  ***
+{ { /*%00000*/ {0xFE, 1},  /*%00000*/ {0xF2, 2},  /*%00000*/ {0x92, 3},  /*%00000*/ {0x92, 3},  /*%00000*/ {0x92, 3} },
+  { /*%00001*/ {0xFF, 1},  /*%00001*/ {0xF9, 2},  /*%00001*/ {0xC9, 3},  /*%00001*/ {0xC9, 3},  /*%00001*/ {0xC9, 3} },
+  {            {0,    0},  /*%00010*/ {0xFA, 2},  /*%00010*/ {0xCA, 3},  /*%00010*/ {0xCA, 3},  /*%00010*/ {0xCA, 3} },
+  {            {0,    0},  /*%00011*/ {0xFD, 2},  /*%00011*/ {0xE5, 3},  /*%00011*/ {0x25, 4},  /*%00011*/ {0x25, 4} },
+  {            {0,    0},             {0,    0},  /*%00100*/ {0xD2, 3},  /*%00100*/ {0xD2, 3},  /*%00100*/ {0xD2, 3} },
+  {            {0,    0},             {0,    0},  /*%00101*/ {0xE9, 3},  /*%00101*/ {0x29, 4},  /*%00101*/ {0x29, 4} },
+  {            {0,    0},             {0,    0},  /*%00110*/ {0xEA, 3},  /*%00110*/ {0x2A, 4},  /*%00110*/ {0x2A, 4} },
+  {            {0,    0},             {0,    0},  /*%00111*/ {0xF5, 3},  /*%00111*/ {0x95, 4},  /*%00111*/ {0x95, 4} },
+  {            {0,    0},             {0,    0},             {0,    0},  /*%01000*/ {0x92, 3},  /*%01000*/ {0x92, 3} },
+  {            {0,    0},             {0,    0},             {0,    0},  /*%01001*/ {0x49, 4},  /*%01001*/ {0x49, 4} },
+  {            {0,    0},             {0,    0},             {0,    0},  /*%01010*/ {0x4A, 4},  /*%01010*/ {0x4A, 4} },
+  {            {0,    0},             {0,    0},             {0,    0},  /*%01011*/ {0xA5, 4},  /*%01011*/ {0xA5, 4} },
+  {            {0,    0},             {0,    0},             {0,    0},  /*%01100*/ {0x52, 4},  /*%01100*/ {0x52, 4} },
+  {            {0,    0},             {0,    0},             {0,    0},  /*%01101*/ {0xA9, 4},  /*%01101*/ {0xA9, 4} },
+  {            {0,    0},             {0,    0},             {0,    0},  /*%01110*/ {0xAA, 4},  /*%01110*/ {0xAA, 4} },
+  {            {0,    0},             {0,    0},             {0,    0},  /*%01111*/ {0xD5, 4},  /*%01111*/ {0xD5, 4} },
+  {            {0,    0},             {0,    0},             {0,    0},             {0,    0},  /*%10000*/ {0x92, 3} },
+  {            {0,    0},             {0,    0},             {0,    0},             {0,    0},  /*%10001*/ {0xC9, 3} },
+  {            {0,    0},             {0,    0},             {0,    0},             {0,    0},  /*%10010*/ {0xCA, 3} },
+  {            {0,    0},             {0,    0},             {0,    0},             {0,    0},  /*%10011*/ {0x25, 4} },
+  {            {0,    0},             {0,    0},             {0,    0},             {0,    0},  /*%10100*/ {0xD2, 3} },
+  {            {0,    0},             {0,    0},             {0,    0},             {0,    0},  /*%10101*/ {0x29, 4} },
+  {            {0,    0},             {0,    0},             {0,    0},             {0,    0},  /*%10110*/ {0x2A, 4} },
+  {            {0,    0},             {0,    0},             {0,    0},             {0,    0},  /*%10111*/ {0x95, 4} },
+  {            {0,    0},             {0,    0},             {0,    0},             {0,    0},  /*%11000*/ {0x92, 3} },
+  {            {0,    0},             {0,    0},             {0,    0},             {0,    0},  /*%11001*/ {0x49, 4} },
+  {            {0,    0},             {0,    0},             {0,    0},             {0,    0},  /*%11010*/ {0x4A, 4} },
+  {            {0,    0},             {0,    0},             {0,    0},             {0,    0},  /*%11011*/ {0xA5, 4} },
+  {            {0,    0},             {0,    0},             {0,    0},             {0,    0},  /*%11100*/ {0x52, 4} },
+  {            {0,    0},             {0,    0},             {0,    0},             {0,    0},  /*%11101*/ {0xA9, 4} },
+  {            {0,    0},             {0,    0},             {0,    0},             {0,    0},  /*%11110*/ {0xAA, 4} },
+  {            {0,    0},             {0,    0},             {0,    0},             {0,    0},  /*%11111*/ {0x55, 5} }
+ };
+
+/* the encoder's carry is the 0-4 input bits left over after encoding a byte (too few to index the 5-bit column
+   while more bytes follow); state (1 << count) - 1 + value identifies a carry of count bits with that value */
+#define CARRY_STATES        31
+#define CARRY_STATE(count, value)   ((1 << (count)) - 1 + (value))
+
+/* a carry and 8 more bits make at most 12 bits which encode to at most 3 bytes before fewer than 5 remain */
+typedef struct {
+    uint8_t encoding[3];    /* encoded bytes to output */
+    uint8_t count;          /* number of encoded bytes */
+    uint8_t next;           /* carry state after the byte */
+} PDSStep;
+
+static PDSStep steps[CARRY_STATES][256];
+static pthread_once_t stepsOnce = PTHREAD_ONCE_INIT;
+
+/* BuildSteps - precompute the encoding of each input byte following each carry */
+static void BuildSteps(void)
+{
+    int carryCount, carryValue, byte;
+
+    for (carryCount = 0; carryCount < 5; ++carryCount) {
+        for (carryValue = 0; carryValue < (1 << carryCount); ++carryValue) {
+            for (byte = 0; byte < 256; ++byte) {
+                PDSStep *step = &steps[CARRY_STATE(carryCount, carryValue)][byte];
+                int bits = carryValue | (byte << carryCount);
+                int bitCount = carryCount + 8;
+                step->count = 0;
+                while (bitCount >= 5) {
+                    step->encoding[step->count++] = PDSTx[bits & 0x1f][4].encoding;
+                    bitCount -= PDSTx[bits & 0x1f][4].bitCount;
+                    bits >>= PDSTx[bits & 0x1f][4].bitCount;
+                }
+                step->next = CARRY_STATE(bitCount, bits);
+            }
+        }
+    }
+}
+
+/* PDSEncodeInit - start encoding a stream */
+void PDSEncodeInit(PDSEncoder *encoder)
+{
+    pthread_once(&stepsOnce, BuildSteps);
+    encoder->state = CARRY_STATE(0, 0);
+}
+
+/* PDSEncodeChunk - encode the next part of a stream a byte at a time using precomputed steps
+
+    parameters:
+        encoder holds the input bits left over from the previous chunk
+        inBytes is a pointer to a buffer of bytes to be encoded
+        inCount is the number of bytes in inBytes
+        outBytes is a pointer to a buffer to receive the encoded bytes
+        outSize is the size of the outBytes buffer
+    returns the number of bytes written to the outBytes buffer or -1 if the encoded data does not fit
+*/
+int PDSEncodeChunk(PDSEncoder *encoder, const uint8_t *inBytes, int inCount, uint8_t *outBytes, int outSize)
+{
+    int state = encoder->state;
+    int outCount = 0;
+    int i;
+
+    /* encode whole bytes while there is certainly room for the output */
+    for (i = 0; i < inCount && outCount <= outSize - 3; ++i) {
+        const PDSStep *step = &steps[state][inBytes[i]];
+        memcpy(&outBytes[outCount], step->encoding, sizeof(step->encoding));
+        outCount += step->count;
+        state = step->next;
+    }
+
+    /* encode any bytes left near the end of the output buffer checking each output byte */
+    for (; i < inCount; ++i) {
+        const PDSStep *step = &steps[state][inBytes[i]];
+        if (outCount + step->count > outSize)
+            return -1;
+        memcpy(&outBytes[outCount], step->encoding, step->count);
+        outCount += step->count;
+        state = step->next;
+    }
+
+    /* return the number of encoded bytes */
+    encoder->state = state;
+    return outCount;
+}
+
+/* PDSEncodeEnd - encode the bits left over at the end of a stream
+
+    The leftover bits are encoded with the narrower columns of PDSTx.  Returns the number of bytes written to the
+    outBytes buffer (at most 4) or -1 if they don't fit.
+*/
+int PDSEncodeEnd(PDSEncoder *encoder, uint8_t *outBytes, int outSize)
+{
+    int outCount = 0;
+    int carryCount, bits;
+
+    for (carryCount = 0; (1 << (carryCount + 1)) - 1 <= encoder->state; ++carryCount)
+        ;
+    bits = encoder->state - CARRY_STATE(carryCount, 0);
+    while (carryCount > 0) {
+        int bitCount = PDSTx[bits][carryCount - 1].bitCount;
+        if (outCount >= outSize)
+            return -1;
+        outBytes[outCount++] = PDSTx[bits][carryCount - 1].encoding;
+        bits >>= bitCount;
+        carryCount -= bitCount;
+    }
+
+    /* return the number of encoded bytes */
+    encoder->state = CARRY_STATE(0, 0);
+    return outCount;
+}
+
+/* PDSEncodeBytes - encode bytes as a Propeller Download Stream
+
+    parameters:
+        inBytes is a pointer to a buffer of bytes to be encoded
+        inCount is the number of bytes in inBytes
+        outBytes is a pointer to a buffer to receive the encoded bytes
+        outSize is the size of the outBytes buffer
+    returns the number of bytes written to the outBytes buffer or -1 if the encoded data does not fit
+*/
+int PDSEncodeBytes(const uint8_t *inBytes, int inCount, uint8_t *outBytes, int outSize)
+{
+    PDSEncoder encoder;
+    int outCount, endCount;
+
+    PDSEncodeInit(&encoder);
+    if ((outCount = PDSEncodeChunk(&encoder, inBytes, inCount, outBytes, outSize)) < 0)
+        return -1;
+    if ((endCount = PDSEncodeEnd(&encoder, outBytes + outCount, outSize - outCount)) < 0)
+        return -1;
+    return outCount + endCount;
+}
+
+/* PDSEncodeBits - encode bytes as a Propeller Download Stream 1-5 bits at a time
+
+    This is the original encoder.  It produces the same output as PDSEncodeBytes and is kept as a reference for
+    checking and benchmarking it.
+*/
+int PDSEncodeBits(const uint8_t *inBytes, int inCount, uint8_t *outBytes, int outSize)
+{
+    static uint8_t masks[] = { 0x00, 0x01, 0x03, 0x07, 0x0f, 0x1f };
+    int bitCount = inCount * 8;
+    int nextBit = 0;
+    int outCount = 0;
+    
+    /* encode all bits in the input buffer */
+    while (nextBit < bitCount) {
+        int bits, bitsIn;
+    
+        /* encode 5 bits or whatever remains in inBytes, whichever is smaller */
+        bitsIn = bitCount - nextBit;
+        if (bitsIn > 5)
+            bitsIn = 5;
+            
+        /* extract the next 'bitsIn' bits from the input buffer */
+        bits = inBytes[nextBit / 8] >> (nextBit % 8);
+        if (nextBit / 8 + 1 < inCount)
+            bits |= inBytes[nextBit / 8 + 1] << (8 - (nextBit % 8));
+        bits &= masks[bitsIn];
+    
+        /* make sure there is enough space in the output buffer */
+        if (outCount >= outSize)
+            return -1;
+            
+        /* store the encoded value */
+        outBytes[outCount++] = PDSTx[bits][bitsIn - 1].encoding;
+        
+        /* advance to the next group of bits */
+        nextBit += PDSTx[bits][bitsIn - 1].bitCount;
+    }
+    
+    /* return the number of encoded bytes */
+    return outCount;
+}
@@ -0,0 +1,32 @@
+#ifndef __PDSENCODE_H__
+#define __PDSENCODE_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* most bytes encoding inCount bytes can take: each input byte encodes to at most 3 bytes and the end of the stream
+   adds at most 4 more */
+#define PDS_MAX_ENCODED_SIZE(inCount)   ((inCount) * 3 + 4)
+
+/* state of an encoding split into chunks: the input bits left over from the last chunk */
+typedef struct {
+    int state;
+} PDSEncoder;
+
+void PDSEncodeInit(PDSEncoder *encoder);
+int PDSEncodeChunk(PDSEncoder *encoder, const uint8_t *inBytes, int inCount, uint8_t *outBytes, int outSize);
+int PDSEncodeEnd(PDSEncoder *encoder, uint8_t *outBytes, int outSize);
+
+/* encode bytes as a Propeller Download Stream for the ROM boot loader; both return the number of encoded bytes or -1
+   if they don't fit in outSize */
+int PDSEncodeBytes(const uint8_t *inBytes, int inCount, uint8_t *outBytes, int outSize);
+int PDSEncodeBits(const uint8_t *inBytes, int inCount, uint8_t *outBytes, int outSize);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -5,6 +5,7 @@
 #include <stdint.h>
 #include <string.h>
 #include "config.h"
+#include "system.h"
 
 typedef enum {
     ltShutdown = 0,
@@ -16,7 +17,7 @@ typedef enum {
 class PropConnection
 {
 public:
-    PropConnection() : m_config(NULL), m_portName(NULL) {}
+    PropConnection() : m_config(NULL), m_portName(NULL), m_baudRate(0), m_srtt(-1), m_rttvar(0) {}
     ~PropConnection() {
         if (m_portName)
             free(m_portName);
@@ -31,11 +32,18 @@ public:
     virtual int loadImage(const uint8_t *image, int imageSize, uint8_t *response, int responseSize) = 0;
     virtual int loadImage(const uint8_t *image, int imageSize, LoadType loadType = ltDownloadAndRun, int info = false) = 0;
     virtual int sendData(const uint8_t *buf, int len) = 0;
+    virtual int sendDataV(const struct iovec *iov, int count) = 0;   // send a scatter-gather list without copying it
     virtual int receiveDataTimeout(uint8_t *buf, int len, int timeout) = 0;
     virtual int receiveDataExactTimeout(uint8_t *buf, int len, int timeout) = 0;
+    virtual int receiveDataExactDeadline(uint8_t *buf, int len, int64_t deadline) = 0;   // deadline is an xbMonotonicMicros time
     virtual int setBaudRate(int baudRate) = 0;
+    virtual bool baudRateSupported(int baudRate) = 0;
     virtual int maxDataSize() = 0;
+    virtual int maxRomImageSize() = 0;
+    virtual int defaultRoundTripTime() = 0;
+    virtual int receiveLatency() = 0;       // milliseconds received data may be held before it's passed on (-1 if not known)
     virtual int terminal(bool checkForExit, bool pstMode) = 0;
+    virtual const char *deviceId() { return portName(); }  // names the device in the baud rate cache
     const char *portName() { return m_portName ? m_portName : "<none>"; }
     void setPortName(const char *portName) {
         if (m_portName)
@@ -45,10 +53,31 @@ public:
     }
     void setConfig(BoardConfig *config) { m_config = config; }
     BoardConfig *config() { return m_config; }
+    int baudRate() { return m_baudRate; }
+    
+    // Round trip latency (the time from sending a packet to receiving its response less the time to send both)
+    // smoothed and with its mean deviation as in TCP's retransmission timer.  Both are in microseconds.
+    bool haveRoundTripTime() { return m_srtt >= 0; }
+    int smoothedRoundTripTime() { return m_srtt; }
+    int roundTripTimeDeviation() { return m_rttvar; }
+    int roundTripTimeEstimate() { return m_srtt >= 0 ? m_srtt : defaultRoundTripTime(); }
+    void addRoundTripSample(int sample) {
+        if (m_srtt < 0) {
+            m_srtt = sample;
+            m_rttvar = sample / 2;
+        }
+        else {
+            int delta = sample - m_srtt;
+            m_srtt += delta / 8;
+            m_rttvar += ((delta < 0 ? -delta : delta) - m_rttvar) / 4;
+        }
+    }
 protected:
     BoardConfig *m_config;
     char *m_portName;
     int m_baudRate;
+    int m_srtt;
+    int m_rttvar;
 };
 
 #endif // PROPCONNECTION_H
@@ -30,6 +30,8 @@
 #ifndef __SERIAL_IO_H__
 #define __SERIAL_IO_H__
 
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -43,16 +45,28 @@ typedef enum {
 
 typedef struct SERIAL SERIAL;
 
+/* defined in system.h */
+struct iovec;
+
 int SerialUseResetMethod(SERIAL *serial, const char *method);
+void SerialSetResetTiming(SERIAL *serial, int pulseTime, int settleTime);
+void SerialGetResetTiming(SERIAL *serial, int *pPulseTime, int *pSettleTime);
 int OpenSerial(const char *port, int baud, SERIAL **pSerial);
 void CloseSerial(SERIAL *serial);
+int SerialStartReader(SERIAL *serial);
+void SerialStopReader(SERIAL *serial);
 int SetSerialBaud(SERIAL *serial, int baud);
+int SerialBaudRateSupported(int baud);
+int SerialGetLatency(SERIAL *serial);
 int SerialGenerateResetSignal(SERIAL *serial);
 int SendSerialData(SERIAL *serial, const void *buf, int len);
+int SendSerialDataV(SERIAL *serial, const struct iovec *iov, int count);
 int FlushSerialData(SERIAL *serial);
+int DiscardSerialOutput(SERIAL *serial);
 int ReceiveSerialData(SERIAL *serial, void *buf, int len);
 int ReceiveSerialDataTimeout(SERIAL *serial, void *buf, int len, int timeout);
 int ReceiveSerialDataExactTimeout(SERIAL *serial, void *buf, int len, int timeout);
+int ReceiveSerialDataExactDeadline(SERIAL *serial, void *buf, int len, int64_t deadline);
 int SerialFind(int (*check)(const char *port, void *data), void *data);
 void SerialTerminal(SERIAL *serial, int check_for_exit, int pst_mode);
 
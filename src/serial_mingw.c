@@ -36,13 +36,21 @@
 #include <stdarg.h>
 #include <stdint.h>
 #include "serial.h"
+#include "system.h"
 
 static void ShowLastError(void);
 
+// Default time (in milliseconds) to hold the Propeller in reset and to wait after releasing it before talking to
+// the ROM boot loader.
+#define DEF_RESET_PULSE_TIME    25
+#define DEF_RESET_SETTLE_TIME   90
+
 struct SERIAL {
     COMMTIMEOUTS originalTimeouts;
     COMMTIMEOUTS timeouts;
     reset_method_t resetMethod;
+    int resetPulseTime;
+    int resetSettleTime;
     HANDLE hSerial;
 };
 
@@ -57,6 +65,35 @@ int SerialUseResetMethod(SERIAL *serial, const char *method)
     return 0;
 }
 
+/* SerialSetResetTiming - set the reset pulse and settle times in milliseconds (a negative time selects the default) */
+void SerialSetResetTiming(SERIAL *serial, int pulseTime, int settleTime)
+{
+    serial->resetPulseTime = pulseTime >= 0 ? pulseTime : DEF_RESET_PULSE_TIME;
+    serial->resetSettleTime = settleTime >= 0 ? settleTime : DEF_RESET_SETTLE_TIME;
+}
+
+void SerialGetResetTiming(SERIAL *serial, int *pPulseTime, int *pSettleTime)
+{
+    *pPulseTime = serial->resetPulseTime;
+    *pSettleTime = serial->resetSettleTime;
+}
+
+/* SerialStartReader - reader threads aren't supported on Windows so the port is always read directly */
+int SerialStartReader(SERIAL *serial)
+{
+    return -1;
+}
+
+void SerialStopReader(SERIAL *serial)
+{
+}
+
+/* SerialGetLatency - get the time in milliseconds the adapter holds received data (-1 if it isn't known) */
+int SerialGetLatency(SERIAL *serial)
+{
+    return -1;
+}
+
 int OpenSerial(const char *port, int baud, SERIAL **pSerial)
 {
     char fullPort[20];
@@ -71,6 +108,8 @@ int OpenSerial(const char *port, int baud, SERIAL **pSerial)
     /* initialize the state structure */
     memset(serial, 0, sizeof(SERIAL));
     serial->resetMethod = RESET_WITH_DTR;
+    serial->resetPulseTime = DEF_RESET_PULSE_TIME;
+    serial->resetSettleTime = DEF_RESET_SETTLE_TIME;
 
     sprintf(fullPort, "\\\\.\\%s", port);
 
@@ -178,12 +217,18 @@ int SetSerialBaud(SERIAL *serial, int baud)
     return 0;
 }
 
+int SerialBaudRateSupported(int baud)
+{
+    /* SetSerialBaud passes any rate to the driver */
+    return baud > 0;
+}
+
 int SerialGenerateResetSignal(SERIAL *serial)
 {
     EscapeCommFunction(serial->hSerial, serial->resetMethod == RESET_WITH_RTS ? SETRTS : SETDTR);
-    Sleep(25);
+    Sleep(serial->resetPulseTime);
     EscapeCommFunction(serial->hSerial, serial->resetMethod == RESET_WITH_RTS ? CLRRTS : CLRDTR);
-    Sleep(90);
+    Sleep(serial->resetSettleTime);
     // Purge here after reset helps to get rid of buffered data.
     PurgeComm(serial->hSerial, PURGE_TXABORT | PURGE_RXABORT | PURGE_TXCLEAR | PURGE_RXCLEAR);
     return 0;
@@ -200,11 +245,28 @@ int SendSerialData(SERIAL *serial, const void *buf, int len)
     return dwBytes;
 }
 
+/* SendSerialDataV - send a scatter-gather list (a comm port takes one buffer at a time) */
+int SendSerialDataV(SERIAL *serial, const struct iovec *iov, int count)
+{
+    int total = 0, i;
+    for (i = 0; i < count; ++i) {
+        if (SendSerialData(serial, iov[i].iov_base, (int)iov[i].iov_len) != (int)iov[i].iov_len)
+            return -1;
+        total += (int)iov[i].iov_len;
+    }
+    return total;
+}
+
 int FlushSerialData(SERIAL *serial)
 {
     return FlushFileBuffers(serial->hSerial) ? 0 : -1;
 }
 
+int DiscardSerialOutput(SERIAL *serial)
+{
+    return PurgeComm(serial->hSerial, PURGE_TXABORT | PURGE_TXCLEAR) ? 0 : -1;
+}
+
 int ReceiveSerialData(SERIAL *serial, void *buf, int len)
 {
     DWORD dwBytes = 0;
@@ -239,40 +301,22 @@ int ReceiveSerialDataTimeout(SERIAL *serial, void *buf, int len, int timeout)
     return dwBytes;
 }
 
-int ReceiveSerialDataExactTimeout(SERIAL *serial, void *buf, int len, int timeout)
+/* ReceiveSerialDataFunc - ReceiveSerialDataTimeout for xbReceiveExactDeadline; a read once the deadline has passed
+   still waits a millisecond since a zero ReadTotalTimeoutConstant doesn't bound ReadFile with these timeouts */
+static int ReceiveSerialDataFunc(void *handle, void *buf, int len, int timeout)
 {
-    uint8_t *ptr = (uint8_t *)buf;
-    int remaining = len;
-    DWORD dwBytes = 0;
-    
-    FlushFileBuffers(serial->hSerial);
+    return ReceiveSerialDataTimeout((SERIAL *)handle, buf, len, timeout > 0 ? timeout : 1);
+}
 
-    serial->timeouts.ReadTotalTimeoutConstant = timeout;
-    SetCommTimeouts(serial->hSerial, &serial->timeouts);
-    
-    /* return only when the buffer contains the exact amount of data requested */
-    while (remaining > 0) {
-    
-        /* read the next bit of data */
-        if (!ReadFile(serial->hSerial, ptr, remaining, &dwBytes, NULL)) {
-            printf("Error reading port\n");
-            ShowLastError();
-            return -1;
-        }
-        
-        /* check for a timeout */
-        if (dwBytes == 0) {
-            //printf("Timeout %d %d\n", len, remaining);
-            return -1;
-        }
-                    
-        /* update the buffer pointer */
-        remaining -= dwBytes;
-        ptr += dwBytes;
-    }
+/* ReceiveSerialDataExactDeadline - receive exactly len bytes before a deadline (an xbMonotonicMicros time) */
+int ReceiveSerialDataExactDeadline(SERIAL *serial, void *buf, int len, int64_t deadline)
+{
+    return xbReceiveExactDeadline(ReceiveSerialDataFunc, serial, buf, len, deadline);
+}
 
-    /* return the full size of the buffer */
-    return len;
+int ReceiveSerialDataExactTimeout(SERIAL *serial, void *buf, int len, int timeout)
+{
+    return ReceiveSerialDataExactDeadline(serial, buf, len, xbDeadline(timeout));
 }
 
 static void ShowLastError(void)
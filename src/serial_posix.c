@@ -45,21 +45,71 @@
 #include <limits.h>
 #include <signal.h>
 #include <ctype.h>
+#include <time.h>
+#include <pthread.h>
 
 #include "serial.h"
 #include "proploader.h"
+#include "system.h"
+#include "ioready.h"
+#ifdef LINUX
+#include "iouring.h"
+#endif
+#ifdef LINUX
+#include <linux/serial.h>
+#include "serial_termios2.h"
+#endif
 #ifdef RASPBERRY_PI
 #include "gpio_sysfs.h"
 #define DEFAULT_GPIO_PIN    17
 #define DEFAULT_GPIO_LEVEL  0
 #endif
+
+// Default time (in milliseconds) to hold the Propeller in reset and to wait after releasing it before talking to
+// the ROM boot loader.
+#define DEF_RESET_PULSE_TIME    10
+#define DEF_RESET_SETTLE_TIME   100
+
+// Time (in milliseconds) a USB serial adapter with a latency timer (FTDI) should hold received data before passing
+// it on.  The default of 16ms is paid on every packet acknowledgement.
+#define LOW_LATENCY_TIMER       1
+
+// Size of the ring a reader thread drains the port into (must be a power of two).
+#define READER_RING_SIZE        65536
+
+/* The reader thread is the only writer of head and the receive functions (called from one thread) are the only
+   writers of tail, so data moves through the ring without locks; the lock is only taken to sleep and wake up and to
+   keep a flush from racing with data the thread read before it. */
+typedef struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;            /* signalled when data arrives or the thread stops */
+    int stopPipe[2];                /* written to stop the thread */
+    IoReadySet *ready;              /* the port and the read end of stopPipe */
+    unsigned int head;              /* total bytes put in the ring */
+    unsigned int tail;              /* total bytes taken from the ring */
+    unsigned int flushCount;        /* bumped by each flush so the thread drops what it read before the flush */
+    int waiting;                    /* a receive function is waiting on cond */
+    int done;                       /* the thread has stopped */
+    int joined;                     /* the thread has been joined (what it received can still be taken) */
+    uint8_t ring[READER_RING_SIZE];
+} SerialReader;
+
 struct SERIAL {
     struct termios oldParams;
     reset_method_t resetMethod;
+    int resetPulseTime;
+    int resetSettleTime;
 #ifdef RASPBERRY_PI
     int resetGpioPin;
     int resetGpioLevel;
 #endif
+#ifdef LINUX
+    int oldSerialFlags;                 /* ASYNC_* flags to restore on close or -1 if they weren't changed */
+    int oldLatencyTimer;                /* latency timer to restore on close or -1 if it wasn't changed */
+    char latencyTimerPath[PATH_MAX];    /* sysfs latency timer attribute or an empty string if there isn't one */
+#endif
+    SerialReader *reader;               /* reader thread state or NULL if the port is read directly */
     int fd;
 };
 
@@ -136,6 +186,118 @@ int SerialUseResetMethod(SERIAL *serial, const char *method)
     return 0;
 }
 
+/* SerialSetResetTiming - set the reset pulse and settle times in milliseconds (a negative time selects the default) */
+void SerialSetResetTiming(SERIAL *serial, int pulseTime, int settleTime)
+{
+    serial->resetPulseTime = pulseTime >= 0 ? pulseTime : DEF_RESET_PULSE_TIME;
+    serial->resetSettleTime = settleTime >= 0 ? settleTime : DEF_RESET_SETTLE_TIME;
+}
+
+void SerialGetResetTiming(SERIAL *serial, int *pPulseTime, int *pSettleTime)
+{
+    *pPulseTime = serial->resetPulseTime;
+    *pSettleTime = serial->resetSettleTime;
+}
+
+#ifdef LINUX
+
+/* ReadLatencyTimer - read a sysfs latency timer attribute; returns -1 if it can't be read */
+static int ReadLatencyTimer(const char *path)
+{
+    FILE *fp;
+    int value;
+    if (!path[0] || !(fp = fopen(path, "r")))
+        return -1;
+    if (fscanf(fp, "%d", &value) != 1)
+        value = -1;
+    fclose(fp);
+    return value;
+}
+
+/* WriteLatencyTimer - write a sysfs latency timer attribute */
+static int WriteLatencyTimer(const char *path, int value)
+{
+    FILE *fp;
+    int sts;
+    if (!(fp = fopen(path, "w")))
+        return -1;
+    sts = fprintf(fp, "%d\n", value) > 0 ? 0 : -1;
+    if (fclose(fp) != 0)
+        sts = -1;
+    return sts;
+}
+
+/* SetLowLatency - ask the driver to pass on received data immediately and shorten an FTDI latency timer
+   (both are only tuning; failures just leave the port as it was) */
+static void SetLowLatency(SERIAL *serial, const char *port)
+{
+    struct serial_struct info;
+    char realPort[PATH_MAX];
+    const char *name;
+    int timer;
+    
+    /* set ASYNC_LOW_LATENCY (remembering the old flags) */
+    serial->oldSerialFlags = -1;
+    if (ioctl(serial->fd, TIOCGSERIAL, &info) == 0 && !(info.flags & ASYNC_LOW_LATENCY)) {
+        int flags = info.flags;
+        info.flags |= ASYNC_LOW_LATENCY;
+        if (ioctl(serial->fd, TIOCSSERIAL, &info) == 0)
+            serial->oldSerialFlags = flags;
+    }
+    
+    /* find the latency timer of the tty device that port names (it may be a symlink like /dev/serial/by-id/...) */
+    serial->oldLatencyTimer = -1;
+    serial->latencyTimerPath[0] = '\0';
+    if (!realpath(port, realPort))
+        return;
+    name = (name = strrchr(realPort, '/')) ? name + 1 : realPort;
+    if (snprintf(serial->latencyTimerPath, sizeof(serial->latencyTimerPath), "/sys/class/tty/%s/device/latency_timer", name)
+            >= (int)sizeof(serial->latencyTimerPath)
+    ||  (timer = ReadLatencyTimer(serial->latencyTimerPath)) < 0) {
+        serial->latencyTimerPath[0] = '\0';
+        return;
+    }
+    
+    /* shorten it for this session */
+    if (timer > LOW_LATENCY_TIMER) {
+        if (WriteLatencyTimer(serial->latencyTimerPath, LOW_LATENCY_TIMER) == 0)
+            serial->oldLatencyTimer = timer;
+        else
+            message("Can't set latency timer of %s -- %s", name, strerror(errno));
+    }
+}
+
+/* LowLatencyEnabled - check whether the driver passes on received data immediately */
+static int LowLatencyEnabled(SERIAL *serial)
+{
+    struct serial_struct info;
+    return ioctl(serial->fd, TIOCGSERIAL, &info) == 0 && (info.flags & ASYNC_LOW_LATENCY) != 0;
+}
+
+/* RestoreLatency - undo SetLowLatency */
+static void RestoreLatency(SERIAL *serial)
+{
+    struct serial_struct info;
+    if (serial->oldLatencyTimer >= 0)
+        WriteLatencyTimer(serial->latencyTimerPath, serial->oldLatencyTimer);
+    if (serial->oldSerialFlags != -1 && ioctl(serial->fd, TIOCGSERIAL, &info) == 0) {
+        info.flags = serial->oldSerialFlags;
+        ioctl(serial->fd, TIOCSSERIAL, &info);
+    }
+}
+
+#endif
+
+/* SerialGetLatency - get the time in milliseconds the adapter holds received data (-1 if it isn't known) */
+int SerialGetLatency(SERIAL *serial)
+{
+#ifdef LINUX
+    return ReadLatencyTimer(serial->latencyTimerPath);
+#else
+    return -1;
+#endif
+}
+
 int OpenSerial(const char *port, int baud, SERIAL **pSerial)
 {
     struct termios sparams;
@@ -154,6 +316,12 @@ int OpenSerial(const char *port, int baud, SERIAL **pSerial)
     serial->resetGpioLevel = DEFAULT_GPIO_LEVEL;
 #else
     serial->resetMethod = RESET_WITH_DTR;
+#endif
+    serial->resetPulseTime = DEF_RESET_PULSE_TIME;
+    serial->resetSettleTime = DEF_RESET_SETTLE_TIME;
+#ifdef LINUX
+    serial->oldSerialFlags = -1;
+    serial->oldLatencyTimer = -1;
 #endif
     serial->fd = -1;
         
@@ -183,13 +351,6 @@ int OpenSerial(const char *port, int baud, SERIAL **pSerial)
 
     fcntl(serial->fd, F_SETFL, 0);
     
-    /* set the baud rate */
-    if ((sts = SetSerialBaud(serial, baud)) != 0) {
-        close(serial->fd);
-        free(serial);
-        return sts;
-    }
-
     /* get the current options */
     chk("tcgetattr", tcgetattr(serial->fd, &serial->oldParams));
     sparams = serial->oldParams;
@@ -214,6 +375,26 @@ int OpenSerial(const char *port, int baud, SERIAL **pSerial)
     chk("tcflush", tcflush(serial->fd, TCIFLUSH));
     chk("tcsetattr", tcsetattr(serial->fd, TCSANOW, &sparams));
 
+    /* set the baud rate (after the options since setting them can also set the speed) */
+    if ((sts = SetSerialBaud(serial, baud)) != 0) {
+        tcsetattr(serial->fd, TCSANOW, &serial->oldParams);
+        close(serial->fd);
+        free(serial);
+        return sts;
+    }
+
+#ifdef LINUX
+    /* pass acknowledgements on as soon as they arrive */
+    SetLowLatency(serial, port);
+    if ((sts = SerialGetLatency(serial)) >= 0)
+        message("Serial port %s: low latency mode %s, latency timer %d ms", port, LowLatencyEnabled(serial) ? "on" : "off", sts);
+    else
+        message("Serial port %s: low latency mode %s, no latency timer", port, LowLatencyEnabled(serial) ? "on" : "off");
+#endif
+
+    /* register the port for waiting on (it is just polled if that fails) */
+    IoReadyRegister(serial->fd);
+
     /* return the serial state structure */
     *pSerial = serial;
     return 0;
@@ -221,101 +402,346 @@ int OpenSerial(const char *port, int baud, SERIAL **pSerial)
 
 void CloseSerial(SERIAL *serial)
 {
+    SerialStopReader(serial);
     if (serial->fd != -1) {
         tcflush(serial->fd, TCIOFLUSH);
         tcsetattr(serial->fd, TCSANOW, &serial->oldParams);
+#ifdef LINUX
+        RestoreLatency(serial);
+#endif
         ioctl(serial->fd, TIOCNXCL);
+        IoReadyUnregister(serial->fd);
         close(serial->fd);
     }
     free(serial);
 }
 
-int SetSerialBaud(SERIAL *serial, int baud)
+/* ReaderThread - move data from the port to the ring until stopped or the port fails */
+static void *ReaderThread(void *data)
 {
-    struct termios sparams;
-    int tbaud = 0;
+    SERIAL *serial = (SERIAL *)data;
+    SerialReader *reader = serial->reader;
+    unsigned int head = reader->head, space, offset, flushCount;
+    ssize_t cnt;
+    int fd;
+    
+    for (;;) {
+    
+        /* wait for room in the ring (the kernel keeps buffering meanwhile) */
+        if ((space = READER_RING_SIZE - (head - __atomic_load_n(&reader->tail, __ATOMIC_ACQUIRE))) == 0) {
+            if (IoReadyWait(reader->stopPipe[0], IO_READ, 1) != 0)
+                break;
+            continue;
+        }
+        
+        /* wait for data or a stop request */
+        if (IoReadyWaitSet(reader->ready, -1, &fd) <= 0 || fd != serial->fd)
+            break;
+        
+        /* read as much as fits before the end of the ring */
+        offset = head & (READER_RING_SIZE - 1);
+        if (space > READER_RING_SIZE - offset)
+            space = READER_RING_SIZE - offset;
+        flushCount = __atomic_load_n(&reader->flushCount, __ATOMIC_ACQUIRE);
+        if ((cnt = read(serial->fd, &reader->ring[offset], space)) <= 0) {
+            if (cnt < 0 && (errno == EINTR || errno == EAGAIN))
+                continue;
+            break;
+        }
+        
+        /* publish it unless the input was flushed while it was being read */
+        pthread_mutex_lock(&reader->lock);
+        if (reader->flushCount == flushCount) {
+            head += cnt;
+            __atomic_store_n(&reader->head, head, __ATOMIC_RELEASE);
+            if (reader->waiting)
+                pthread_cond_broadcast(&reader->cond);
+        }
+        pthread_mutex_unlock(&reader->lock);
+    }
+    
+    pthread_mutex_lock(&reader->lock);
+    reader->done = 1;
+    pthread_cond_broadcast(&reader->cond);
+    pthread_mutex_unlock(&reader->lock);
+    return NULL;
+}
 
+/* ReaderReceive - take up to len bytes (exactly len if exact) from the ring waiting up to timeout milliseconds
+   (forever if timeout is negative); returns -1 if nothing (or not enough) arrived in time */
+static int ReaderReceive(SERIAL *serial, uint8_t *buf, int len, int exact, int timeout)
+{
+    SerialReader *reader = serial->reader;
+    unsigned int head, tail = reader->tail, n, offset, first;
+    struct timespec deadline;
+    int cnt = 0, sts = 0;
+    
+    /* find the deadline on the clock the condition variable uses */
+    if (timeout > 0) {
+#ifdef MACOSX
+        clock_gettime(CLOCK_REALTIME, &deadline);
+#else
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+#endif
+        deadline.tv_sec += timeout / 1000;
+        deadline.tv_nsec += (timeout % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_nsec -= 1000000000L;
+            ++deadline.tv_sec;
+        }
+    }
+    
+    while (cnt < len) {
+    
+        /* take whatever is in the ring */
+        if ((head = __atomic_load_n(&reader->head, __ATOMIC_ACQUIRE)) != tail) {
+            if ((n = head - tail) > (unsigned int)(len - cnt))
+                n = len - cnt;
+            offset = tail & (READER_RING_SIZE - 1);
+            first = n < READER_RING_SIZE - offset ? n : READER_RING_SIZE - offset;
+            memcpy(&buf[cnt], &reader->ring[offset], first);
+            memcpy(&buf[cnt + first], reader->ring, n - first);
+            tail += n;
+            cnt += n;
+            __atomic_store_n(&reader->tail, tail, __ATOMIC_RELEASE);
+            if (!exact)
+                break;
+            continue;
+        }
+        
+        /* sleep until the reader thread puts more in */
+        if (sts != 0 || timeout == 0)
+            return -1;
+        pthread_mutex_lock(&reader->lock);
+        reader->waiting = 1;
+        while (__atomic_load_n(&reader->head, __ATOMIC_ACQUIRE) == tail && !reader->done && sts == 0)
+            sts = timeout < 0 ? pthread_cond_wait(&reader->cond, &reader->lock)
+                              : pthread_cond_timedwait(&reader->cond, &reader->lock, &deadline);
+        reader->waiting = 0;
+        if (reader->done)
+            sts = -1;
+        pthread_mutex_unlock(&reader->lock);
+    }
+    
+    return cnt;
+}
+
+/* FlushInput - discard input received by the port and not yet taken by a receive function */
+static void FlushInput(SERIAL *serial)
+{
+    SerialReader *reader = serial->reader;
+    if (!reader)
+        chk("tcflush", tcflush(serial->fd, TCIFLUSH));
+    else {
+        pthread_mutex_lock(&reader->lock);
+        __atomic_store_n(&reader->flushCount, reader->flushCount + 1, __ATOMIC_RELEASE);
+        chk("tcflush", tcflush(serial->fd, TCIFLUSH));
+        __atomic_store_n(&reader->tail, __atomic_load_n(&reader->head, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&reader->lock);
+    }
+}
+
+/* SerialStartReader - start a thread that reads the port into a ring so receives don't need system calls */
+int SerialStartReader(SERIAL *serial)
+{
+    SerialReader *reader;
+    pthread_condattr_t attr;
+    
+    if (serial->reader)
+        return 0;
+    if (!(reader = (SerialReader *)malloc(sizeof(SerialReader))))
+        return -1;
+    memset(reader, 0, sizeof(SerialReader));
+    if (pipe(reader->stopPipe) != 0) {
+        free(reader);
+        return -1;
+    }
+    if (!(reader->ready = IoReadyCreate())
+    ||  IoReadyAdd(reader->ready, serial->fd, IO_READ) != 0
+    ||  IoReadyAdd(reader->ready, reader->stopPipe[0], IO_READ) != 0) {
+        IoReadyDestroy(reader->ready);
+        close(reader->stopPipe[0]);
+        close(reader->stopPipe[1]);
+        free(reader);
+        return -1;
+    }
+    
+    pthread_mutex_init(&reader->lock, NULL);
+    pthread_condattr_init(&attr);
+#ifndef MACOSX
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+#endif
+    pthread_cond_init(&reader->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    
+    serial->reader = reader;
+    if (pthread_create(&reader->thread, NULL, ReaderThread, serial) != 0) {
+        serial->reader = NULL;
+        pthread_cond_destroy(&reader->cond);
+        pthread_mutex_destroy(&reader->lock);
+        IoReadyDestroy(reader->ready);
+        close(reader->stopPipe[0]);
+        close(reader->stopPipe[1]);
+        free(reader);
+        return -1;
+    }
+    
+    return 0;
+}
+
+/* JoinReader - stop the reader thread keeping what it received in the ring */
+static void JoinReader(SerialReader *reader)
+{
+    if (!reader->joined) {
+        chk("write", write(reader->stopPipe[1], "", 1) == 1 ? 0 : -1);
+        pthread_join(reader->thread, NULL);
+        reader->joined = 1;
+    }
+}
+
+/* SerialStopReader - stop the reader thread (discarding anything it received that hasn't been taken) */
+void SerialStopReader(SERIAL *serial)
+{
+    SerialReader *reader = serial->reader;
+    if (reader) {
+        JoinReader(reader);
+        pthread_cond_destroy(&reader->cond);
+        pthread_mutex_destroy(&reader->lock);
+        IoReadyDestroy(reader->ready);
+        close(reader->stopPipe[0]);
+        close(reader->stopPipe[1]);
+        free(reader);
+        serial->reader = NULL;
+    }
+}
+
+// Percentage by which the baud rate a driver selects may differ from the one asked for (about a third of the error
+// an asynchronous receiver can tolerate, which leaves the rest for the Propeller's clock).
+#define BAUD_RATE_TOLERANCE     2
+
+/* BaudRateSpeed - map a baud rate to its termios speed constant; returns 0 if there isn't one */
+static speed_t BaudRateSpeed(int baud)
+{
     switch(baud) {
     case 0: // default
-        tbaud = B115200;
-        break;
+        return B115200;
+#ifdef B3000000
+    case 3000000:
+        return B3000000;
+#endif
+#ifdef B2500000
+    case 2500000:
+        return B2500000;
+#endif
+#ifdef B2000000
+    case 2000000:
+        return B2000000;
+#endif
+#ifdef B1500000
+    case 1500000:
+        return B1500000;
+#endif
+#ifdef B1152000
+    case 1152000:
+        return B1152000;
+#endif
+#ifdef B1000000
+    case 1000000:
+        return B1000000;
+#endif
 #ifdef B921600
     case 921600:
-        tbaud = B921600;
-        break;
+        return B921600;
 #endif
 #ifdef B576000
     case 576000:
-        tbaud = B576000;
-        break;
+        return B576000;
 #endif
 #ifdef B500000
     case 500000:
-        tbaud = B500000;
-        break;
+        return B500000;
 #endif
 #ifdef B460800
     case 460800:
-        tbaud = B460800;
-        break;
+        return B460800;
 #endif
 #ifdef B230400
     case 230400:
-        tbaud = B230400;
-        break;
+        return B230400;
 #endif
     case 115200:
-        tbaud = B115200;
-        break;
+        return B115200;
     case 57600:
-        tbaud = B57600;
-        break;
+        return B57600;
     case 38400:
-        tbaud = B38400;
-        break;
+        return B38400;
     case 19200:
-        tbaud = B19200;
-        break;
+        return B19200;
     case 9600:
-        tbaud = B9600;
-        break;
-    default:
-        tbaud = baud; break;
-        printf("Unsupported baudrate. Use ");
-#ifdef B921600
-        printf("921600, ");
-#endif
-#ifdef B576000
-        printf("576000, ");
-#endif
-#ifdef B500000
-        printf("500000, ");
-#endif
-#ifdef B460800
-        printf("460800, ");
-#endif
-#ifdef B230400
-        printf("230400, ");
-#endif
-        printf("115200, 57600, 38400, 19200, or 9600\n");
-        return -1;
+        return B9600;
     }
+    return 0;
+}
+
+/* SerialBaudRateSupported - check whether SetSerialBaud can ask for a baud rate (the driver may still refuse it) */
+int SerialBaudRateSupported(int baud)
+{
+#if defined(MACOSX) || defined(LINUX)
+    /* the speed is passed to cfsetspeed or termios2 as a number */
+    return baud > 0;
+#else
+    return baud > 0 && BaudRateSpeed(baud) != 0;
+#endif
+}
+
+/* returns:
+    0 for success
+    -1 if the driver didn't select the baud rate (or one within BAUD_RATE_TOLERANCE percent of it)
+*/
+int SetSerialBaud(SERIAL *serial, int baud)
+{
+    struct termios sparams;
+    speed_t tbaud;
+    int actualBaud;
+
+    /* other baud rates are passed to cfsetspeed as a number on Mac OS X and set with termios2 on Linux */
+    if (baud == 0)
+        baud = 115200;
+    tbaud = BaudRateSpeed(baud);
     
     /* get the current options */
     chk("tcgetattr", tcgetattr(serial->fd, &sparams));
     
     /* set raw input */
 #ifdef MACOSX
-    chk("cfsetspeed", cfsetspeed(&sparams, tbaud));
+    chk("cfsetspeed", cfsetspeed(&sparams, tbaud ? tbaud : baud));
 #else
-    chk("cfsetispeed", cfsetispeed(&sparams, tbaud));
-    chk("cfsetospeed", cfsetospeed(&sparams, tbaud));
+    if (tbaud) {
+        chk("cfsetispeed", cfsetispeed(&sparams, tbaud));
+        chk("cfsetospeed", cfsetospeed(&sparams, tbaud));
+    }
 #endif
 
     /* set the options */
-    chk("tcflush", tcflush(serial->fd, TCIFLUSH));
+    FlushInput(serial);
     chk("tcsetattr", tcsetattr(serial->fd, TCSANOW, &sparams));
     
+    /* read back the rate the driver selected */
+#ifdef LINUX
+    if (!tbaud && Termios2SetBaud(serial->fd, baud) != 0) {
+        message("Can't set baud rate %d", baud);
+        return -1;
+    }
+    actualBaud = Termios2GetBaud(serial->fd);
+#else
+    chk("tcgetattr", tcgetattr(serial->fd, &sparams));
+    actualBaud = cfgetospeed(&sparams) == (tbaud ? tbaud : (speed_t)baud) ? baud : 0;
+#endif
+    if (actualBaud >= 0 && abs(actualBaud - baud) > baud / 100 * BAUD_RATE_TOLERANCE) {
+        message("Serial port selected baud rate %d instead of %d", actualBaud, baud);
+        return -1;
+    }
+    
     return 0;
 }
 
@@ -343,7 +769,7 @@ int SerialGenerateResetSignal(SERIAL *serial)
         break;
     }
 
-    msleep(10);
+    msleep(serial->resetPulseTime);
     
     /* deassert the reset signal */
     switch (serial->resetMethod) {
@@ -365,10 +791,10 @@ int SerialGenerateResetSignal(SERIAL *serial)
         break;
     }
 
-    msleep(100);
+    msleep(serial->resetSettleTime);
     
     /* flush any pending input */
-    tcflush(serial->fd, TCIFLUSH);
+    FlushInput(serial);
     
     return 0;
 }
@@ -376,6 +802,11 @@ int SerialGenerateResetSignal(SERIAL *serial)
 int SendSerialData(SERIAL *serial, const void *buf, int len)
 {
     int cnt;
+#ifdef LINUX
+    if (IoUringEnabled())
+        cnt = IoUringWrite(serial->fd, buf, len);
+    else
+#endif
     cnt = write(serial->fd, buf, len);
     if (cnt != len) {
         message("Error writing port");
@@ -384,14 +815,52 @@ int SendSerialData(SERIAL *serial, const void *buf, int len)
     return cnt;
 }
 
+/* WriteSerialFunc - write for xbSendRestV */
+static int WriteSerialFunc(void *handle, const void *buf, int len)
+{
+    return (int)write(((SERIAL *)handle)->fd, buf, len);
+}
+
+/* SendSerialDataV - send a scatter-gather list with one system call (unless the port takes only part of it) */
+int SendSerialDataV(SERIAL *serial, const struct iovec *iov, int count)
+{
+    int len = xbIoVecSize(iov, count);
+    int cnt;
+#ifdef LINUX
+    if (IoUringEnabled())
+        cnt = IoUringWriteV(serial->fd, iov, count);
+    else
+#endif
+    if ((cnt = (int)writev(serial->fd, iov, count)) >= 0 && cnt < len)
+        cnt = xbSendRestV(WriteSerialFunc, serial, iov, count, cnt);
+    if (cnt != len) {
+        message("Error writing port");
+        return -1;
+    }
+    return cnt;
+}
+
 int FlushSerialData(SERIAL *serial)
 {
     return tcdrain(serial->fd);
 }
 
+int DiscardSerialOutput(SERIAL *serial)
+{
+    return tcflush(serial->fd, TCOFLUSH);
+}
+
 int ReceiveSerialData(SERIAL *serial, void *buf, int len)
 {
-    int cnt = read(serial->fd, buf, len);
+    int cnt;
+    if (serial->reader)
+        cnt = ReaderReceive(serial, (uint8_t *)buf, len, 0, -1);
+#ifdef LINUX
+    else if (IoUringEnabled())
+        cnt = IoUringRead(serial->fd, buf, len, -1);
+#endif
+    else
+        cnt = read(serial->fd, buf, len);
     if (cnt < 1) {
         message("Error reading port");
         return -1;
@@ -401,67 +870,49 @@ int ReceiveSerialData(SERIAL *serial, void *buf, int len)
 
 int ReceiveSerialDataTimeout(SERIAL *serial, void *buf, int len, int timeout)
 {
-    ssize_t bytes = 0;
-    struct timeval toval;
-    fd_set set;
+    ssize_t bytes;
 
-    /* initialize the socket set */
-    FD_ZERO(&set);
-    FD_SET(serial->fd, &set);
+    /* take the data from the reader thread if there is one */
+    if (serial->reader)
+        return ReaderReceive(serial, (uint8_t *)buf, len, 0, timeout);
 
-    /* setup the timeout */
-    toval.tv_sec = timeout / 1000;
-    toval.tv_usec = (timeout % 1000) * 1000;
+#ifdef LINUX
+    /* or wait for it and read it in one operation */
+    if (IoUringEnabled())
+        return (bytes = IoUringRead(serial->fd, buf, len, timeout)) > 0 ? (int)bytes : -1;
+#endif
 
     /* wait for data to be available on the port */
-    if (select(serial->fd + 1, &set, NULL, NULL, &toval) <= 0)
+    if (IoReadyWait(serial->fd, IO_READ, timeout) <= 0)
         return -1;
 
     /* read the incoming data */
-    if (FD_ISSET(serial->fd, &set))
-        bytes = read(serial->fd, buf, len);
+    bytes = read(serial->fd, buf, len);
 
     return (int)(bytes > 0 ? bytes : -1);
 }
 
-int ReceiveSerialDataExactTimeout(SERIAL *serial, void *buf, int len, int timeout)
+/* ReceiveSerialDataFunc - ReceiveSerialDataTimeout for xbReceiveExactDeadline */
+static int ReceiveSerialDataFunc(void *handle, void *buf, int len, int timeout)
 {
-    uint8_t *ptr = (uint8_t *)buf;
-    int remaining = len;
-    int cnt = 0;
-    struct timeval toval;
-    fd_set set;
-
-    /* return only when the buffer contains the exact amount of data requested */
-    while (remaining > 0) {
-        
-        /* initialize the socket set */
-        FD_ZERO(&set);
-        FD_SET(serial->fd, &set);
-
-        /* setup the timeout */
-        toval.tv_sec = timeout / 1000;
-        toval.tv_usec = (timeout % 1000) * 1000;
-
-        /* wait for data to be available on the port */
-        if (select(serial->fd + 1, &set, NULL, NULL, &toval) <= 0)
-            return -1;
+    return ReceiveSerialDataTimeout((SERIAL *)handle, buf, len, timeout);
+}
 
-        /* read the incoming data */
-        if (FD_ISSET(serial->fd, &set)) {
+/* ReceiveSerialDataExactDeadline - receive exactly len bytes before a deadline (an xbMonotonicMicros time) */
+int ReceiveSerialDataExactDeadline(SERIAL *serial, void *buf, int len, int64_t deadline)
+{
+    /* take the data from the reader thread if there is one */
+    if (serial->reader)
+        return ReaderReceive(serial, (uint8_t *)buf, len, 1, xbMillisUntil(deadline));
         
-            /* read the next bit of data */
-            if ((cnt = read(serial->fd, ptr, remaining)) < 0)
-                return -1;
-                
-            /* update the buffer pointer */
-            remaining -= cnt;
-            ptr += cnt;
-        }
-    }
+    /* return only when the buffer contains the exact amount of data requested */
+    return xbReceiveExactDeadline(ReceiveSerialDataFunc, serial, buf, len, deadline);
+}
 
-    /* return the full size of the buffer */
-    return len;
+/* ReceiveSerialDataExactTimeout - receive exactly len bytes within timeout milliseconds in all */
+int ReceiveSerialDataExactTimeout(SERIAL *serial, void *buf, int len, int timeout)
+{
+    return ReceiveSerialDataExactDeadline(serial, buf, len, xbDeadline(timeout));
 }
 
 static int CheckPrefix(const char *prefix)
@@ -522,13 +973,23 @@ void SerialTerminal(SERIAL *serial, int check_for_exit, int pst_mode)
     struct termios oldt, newt;
     char buf[128], realbuf[256]; // double in case buf is filled with \r in PST mode
     ssize_t cnt;
-    fd_set set;
+    IoReadySet *ready;
+    int readyFd;
     int exit_char = 0xdead; /* not a valid character */
     int sawexit_char = 0;
     int sawexit_valid = 0; 
     int exitcode = 0;
     int continue_terminal = 1;
 
+    /* wait on the port and the keyboard together */
+    if (!(ready = IoReadyCreate())
+    ||  IoReadyAdd(ready, serial->fd, IO_READ) != 0
+    ||  IoReadyAdd(ready, STDIN_FILENO, IO_READ) != 0) {
+        message("Can't wait for terminal input");
+        IoReadyDestroy(ready);
+        return;
+    }
+
     tcgetattr(STDIN_FILENO, &oldt);
     newt = oldt;
     newt.c_lflag &= ~(ICANON | ECHO | ISIG);
@@ -548,12 +1009,22 @@ void SerialTerminal(SERIAL *serial, int check_for_exit, int pst_mode)
 #endif
 
     do {
-        FD_ZERO(&set);
-        FD_SET(serial->fd, &set);
-        FD_SET(STDIN_FILENO, &set);
-        if (select(serial->fd + 1, &set, NULL, NULL, NULL) > 0) {
-            if (FD_ISSET(serial->fd, &set)) {
-                if ((cnt = read(serial->fd, buf, sizeof(buf))) > 0) {
+        
+        /* stop a reader thread and show what it received before reading the port directly; stopping it first means
+           nothing it reads can be left behind in the ring */
+        cnt = 0;
+        readyFd = -1;
+        if (serial->reader) {
+            JoinReader(serial->reader);
+            if ((cnt = ReaderReceive(serial, (uint8_t *)buf, sizeof(buf), 0, 0)) <= 0) {
+                SerialStopReader(serial);
+                cnt = 0;
+            }
+        }
+        
+        if (cnt || IoReadyWaitSet(ready, -1, &readyFd) > 0) {
+            if (cnt || readyFd == serial->fd) {
+                if (cnt || (cnt = read(serial->fd, buf, sizeof(buf))) > 0) {
                     int i;
                     // check for breaks
                     ssize_t realbytes = 0;
@@ -582,7 +1053,7 @@ void SerialTerminal(SERIAL *serial, int check_for_exit, int pst_mode)
                     write(fileno(stdout), realbuf, realbytes);
                 }
             }
-            if (FD_ISSET(STDIN_FILENO, &set)) {
+            if (readyFd == STDIN_FILENO) {
                 if ((cnt = read(STDIN_FILENO, buf, sizeof(buf))) > 0) {
                     int i;
                     for (i = 0; i < cnt; ++i) {
@@ -597,6 +1068,7 @@ void SerialTerminal(SERIAL *serial, int check_for_exit, int pst_mode)
 
 done:
     tcsetattr(STDIN_FILENO, TCSANOW, &oldt);
+    IoReadyDestroy(ready);
 
     if (sawexit_valid)
         exit(exitcode);
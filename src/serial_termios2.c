@@ -0,0 +1,33 @@
+#include <asm/termbits.h>
+#include <asm/ioctls.h>
+#include <sys/ioctl.h>
+
+#include "serial_termios2.h"
+
+/* Termios2SetBaud - select any baud rate with BOTHER instead of one of the fixed Bxxxx speeds */
+int Termios2SetBaud(int fd, int baud)
+{
+    struct termios2 params;
+    
+    if (ioctl(fd, TCGETS2, &params) != 0)
+        return -1;
+    params.c_cflag &= ~(CBAUD | (CBAUD << IBSHIFT));
+    params.c_cflag |= BOTHER | (BOTHER << IBSHIFT);
+    params.c_ispeed = baud;
+    params.c_ospeed = baud;
+    if (ioctl(fd, TCSETS2, &params) != 0)
+        return -1;
+    
+    return 0;
+}
+
+/* Termios2GetBaud - get the baud rate the driver actually selected (it may round or refuse the one asked for) */
+int Termios2GetBaud(int fd)
+{
+    struct termios2 params;
+    
+    if (ioctl(fd, TCGETS2, &params) != 0)
+        return -1;
+    
+    return (int)params.c_ospeed;
+}
@@ -0,0 +1,16 @@
+#ifndef __SERIAL_TERMIOS2_H__
+#define __SERIAL_TERMIOS2_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Linux only: these use the kernel's termios2 interface, which can't be mixed with <termios.h> in one file */
+int Termios2SetBaud(int fd, int baud);
+int Termios2GetBaud(int fd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
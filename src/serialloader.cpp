@@ -9,58 +9,15 @@
 #include <math.h>
 #include <unistd.h>
 #include "serialpropconnection.h"
+#include "pdsencode.h"
 #include "loader.h"
+#include "loadtrace.h"
 #include "proploader.h"
 
 #define MAX_BUFFER_SIZE         32768   /* The maximum buffer size. (BUG: git rid of this magic number) */
 #define LENGTH_FIELD_SIZE       11      /* number of bytes in the length field */
-
-// Propeller Download Stream Translator array.  Index into this array using the "Binary Value" (usually 5 bits) to translate,
-// the incoming bit size (again, usually 5), and the desired data element to retrieve (encoding = translation, bitCount = bit count
-// actually translated.
-
-// first index is the next 1-5 bits from the incoming bit stream
-// second index is the number of bits in the first value
-// the result is a structure containing the byte to output to encode some or all of the input bits
-static struct {
-    uint8_t encoding;   // encoded byte to output
-    uint8_t bitCount;   // number of bits encoded by the output byte
-} PDSTx[32][5] =
-
-//  ***  1-BIT  ***        ***  2-BIT  ***        ***  3-BIT  ***        ***  4-BIT  ***        ***  5-BIT  ***
-{ { /*%00000*/ {0xFE, 1},  /*%00000*/ {0xF2, 2},  /*%00000*/ {0x92, 3},  /*%00000*/ {0x92, 3},  /*%00000*/ {0x92, 3} },
-  { /*%00001*/ {0xFF, 1},  /*%00001*/ {0xF9, 2},  /*%00001*/ {0xC9, 3},  /*%00001*/ {0xC9, 3},  /*%00001*/ {0xC9, 3} },
-  {            {0,    0},  /*%00010*/ {0xFA, 2},  /*%00010*/ {0xCA, 3},  /*%00010*/ {0xCA, 3},  /*%00010*/ {0xCA, 3} },
-  {            {0,    0},  /*%00011*/ {0xFD, 2},  /*%00011*/ {0xE5, 3},  /*%00011*/ {0x25, 4},  /*%00011*/ {0x25, 4} },
-  {            {0,    0},             {0,    0},  /*%00100*/ {0xD2, 3},  /*%00100*/ {0xD2, 3},  /*%00100*/ {0xD2, 3} },
-  {            {0,    0},             {0,    0},  /*%00101*/ {0xE9, 3},  /*%00101*/ {0x29, 4},  /*%00101*/ {0x29, 4} },
-  {            {0,    0},             {0,    0},  /*%00110*/ {0xEA, 3},  /*%00110*/ {0x2A, 4},  /*%00110*/ {0x2A, 4} },
-  {            {0,    0},             {0,    0},  /*%00111*/ {0xFA, 3},  /*%00111*/ {0x95, 4},  /*%00111*/ {0x95, 4} },
-  {            {0,    0},             {0,    0},             {0,    0},  /*%01000*/ {0x92, 3},  /*%01000*/ {0x92, 3} },
-  {            {0,    0},             {0,    0},             {0,    0},  /*%01001*/ {0x49, 4},  /*%01001*/ {0x49, 4} },
-  {            {0,    0},             {0,    0},             {0,    0},  /*%01010*/ {0x4A, 4},  /*%01010*/ {0x4A, 4} },
-  {            {0,    0},             {0,    0},             {0,    0},  /*%01011*/ {0xA5, 4},  /*%01011*/ {0xA5, 4} },
-  {            {0,    0},             {0,    0},             {0,    0},  /*%01100*/ {0x52, 4},  /*%01100*/ {0x52, 4} },
-  {            {0,    0},             {0,    0},             {0,    0},  /*%01101*/ {0xA9, 4},  /*%01101*/ {0xA9, 4} },
-  {            {0,    0},             {0,    0},             {0,    0},  /*%01110*/ {0xAA, 4},  /*%01110*/ {0xAA, 4} },
-  {            {0,    0},             {0,    0},             {0,    0},  /*%01111*/ {0xD5, 4},  /*%01111*/ {0xD5, 4} },
-  {            {0,    0},             {0,    0},             {0,    0},             {0,    0},  /*%10000*/ {0x92, 3} },
-  {            {0,    0},             {0,    0},             {0,    0},             {0,    0},  /*%10001*/ {0xC9, 3} },
-  {            {0,    0},             {0,    0},             {0,    0},             {0,    0},  /*%10010*/ {0xCA, 3} },
-  {            {0,    0},             {0,    0},             {0,    0},             {0,    0},  /*%10011*/ {0x25, 4} },
-  {            {0,    0},             {0,    0},             {0,    0},             {0,    0},  /*%10100*/ {0xD2, 3} },
-  {            {0,    0},             {0,    0},             {0,    0},             {0,    0},  /*%10101*/ {0x29, 4} },
-  {            {0,    0},             {0,    0},             {0,    0},             {0,    0},  /*%10110*/ {0x2A, 4} },
-  {            {0,    0},             {0,    0},             {0,    0},             {0,    0},  /*%10111*/ {0x95, 4} },
-  {            {0,    0},             {0,    0},             {0,    0},             {0,    0},  /*%11000*/ {0x92, 3} },
-  {            {0,    0},             {0,    0},             {0,    0},             {0,    0},  /*%11001*/ {0x49, 4} },
-  {            {0,    0},             {0,    0},             {0,    0},             {0,    0},  /*%11010*/ {0x4A, 4} },
-  {            {0,    0},             {0,    0},             {0,    0},             {0,    0},  /*%11011*/ {0xA5, 4} },
-  {            {0,    0},             {0,    0},             {0,    0},             {0,    0},  /*%11100*/ {0x52, 4} },
-  {            {0,    0},             {0,    0},             {0,    0},             {0,    0},  /*%11101*/ {0xA9, 4} },
-  {            {0,    0},             {0,    0},             {0,    0},             {0,    0},  /*%11110*/ {0xAA, 4} },
-  {            {0,    0},             {0,    0},             {0,    0},             {0,    0},  /*%11111*/ {0x55, 5} }
- };
+#define VERIFY_TEMPLATE_COUNT   1024    /* number of timing templates sent after the identify packet */
+#define ENCODE_CHUNK_SIZE       1024    /* number of image bytes encoded at a time while sending a loader packet */
 
 // After reset, the Propeller's exact clock rate is not known by either the host or the Propeller itself, so communication
 // with the Propeller takes place based on a host-transmitted timing template that the Propeller uses to read the stream
@@ -143,48 +100,6 @@ static uint8_t rxHandshake[] = {
     0xEE,0xCE,0xCF,0xCE,0xCE,0xCF,0xCE,0xEE,0xEF,0xEE,0xEF,0xEF,0xCF,0xEF,0xCE,0xCE,
     0xEF,0xCE,0xEE,0xCE,0xEF,0xCE,0xCE,0xEE,0xCF,0xCF,0xCE,0xCF,0xCF};
 
-/* EncodeBytes
-    parameters:
-        inBytes is a pointer to a buffer of bytes to be encoded
-        inCount is the number of bytes in inBytes
-        outBytes is a pointer to a buffer to receive the encoded bytes
-        outSize is the size of the outBytes buffer
-    returns the number of bytes written to the outBytes buffer or -1 if the encoded data does not fit
-*/
-static int EncodeBytes(const uint8_t *inBytes, int inCount, uint8_t *outBytes, int outSize)
-{
-    static uint8_t masks[] = { 0x00, 0x01, 0x03, 0x07, 0x0f, 0x1f };
-    int bitCount = inCount * 8;
-    int nextBit = 0;
-    int outCount = 0;
-    
-    /* encode all bits in the input buffer */
-    while (nextBit < bitCount) {
-        int bits, bitsIn;
-    
-        /* encode 5 bits or whatever remains in inBytes, whichever is smaller */
-        bitsIn = bitCount - nextBit;
-        if (bitsIn > 5)
-            bitsIn = 5;
-            
-        /* extract the next 'bitsIn' bits from the input buffer */
-        bits = ((inBytes[nextBit / 8] >> (nextBit % 8)) | (inBytes[nextBit / 8 + 1] << (8 - (nextBit % 8)))) & masks[bitsIn];
-    
-        /* make sure there is enough space in the output buffer */
-        if (outCount >= outSize)
-            return -1;
-            
-        /* store the encoded value */
-        outBytes[outCount++] = PDSTx[bits][bitsIn - 1].encoding;
-        
-        /* advance to the next group of bits */
-        nextBit += PDSTx[bits][bitsIn - 1].bitCount;
-    }
-    
-    /* return the number of encoded bytes */
-    return outCount;
-}
-
 static uint8_t *GenerateIdentifyPacket(int *pLength)
 {
     uint8_t *packet;
@@ -206,17 +121,13 @@ static uint8_t *GenerateIdentifyPacket(int *pLength)
     return packet;
 }
 
-static uint8_t *GenerateLoaderPacket(const uint8_t *image, int imageSize, int *pLength, LoadType loadType)
+/* GenerateLoaderHeader - build the part of the loader packet that precedes the encoded image: the handshake, the
+   command and the image length; returns the length of the header or -1 for an invalid load type */
+static int GenerateLoaderHeader(int imageSize, LoadType loadType, uint8_t *header)
 {
     int imageSizeInLongs = (imageSize + 3) / 4;
-    uint8_t encodedImage[MAX_BUFFER_SIZE * 8]; // worst case assuming one byte per bit encoding
-    int encodedImageSize, packetSize, cmdLen, tmp, i;
-    uint8_t *packet, *cmd, *p;
-    
-    /* encode the image */
-    encodedImageSize = EncodeBytes(image, imageSize, encodedImage, sizeof(encodedImage));
-    if (encodedImageSize < 0)
-        return NULL;
+    int cmdLen, tmp, i;
+    uint8_t *cmd, *p;
     
     /* select command */
     switch (loadType) {
@@ -237,39 +148,82 @@ static uint8_t *GenerateLoaderPacket(const uint8_t *image, int imageSize, int *p
         cmdLen = sizeof(programRunCmd);
         break;
     default:
-        return NULL;
+        return -1;
     }
         
-    /* determine the size of the packet */
-    packetSize = sizeof(txHandshake) + cmdLen + LENGTH_FIELD_SIZE + encodedImageSize;
+    /* copy the handshake image and the command to the header */
+    memcpy(header, txHandshake, sizeof(txHandshake));
+    memcpy(header + sizeof(txHandshake), cmd, cmdLen);
     
-    /* allocate space for the full packet */
-    if (!(packet = (uint8_t *)malloc(packetSize)))
-        return NULL;
-        
-    /* copy the handshake image and the command to the packet */
-    memcpy(packet, txHandshake, sizeof(txHandshake));
-
-    /* copy the command to the packet */
-    memcpy(packet + sizeof(txHandshake), cmd, cmdLen);
-    
-    /* build the packet from the handshake data, the image length and the encoded image */
-    p = packet + sizeof(txHandshake) + cmdLen;
+    /* add the image length */
+    p = header + sizeof(txHandshake) + cmdLen;
     tmp = imageSizeInLongs;
     for (i = 0; i < LENGTH_FIELD_SIZE; ++i) {
         *p++ = 0x92 | (i == 10 ? 0x60 : 0x00) | (tmp & 1) | ((tmp & 2) << 2) | ((tmp & 4) << 4);
         tmp >>= 3;
     }
-    memcpy(p, encodedImage, encodedImageSize);
     
-    /* return the packet and its length */
-    *pLength = packetSize;
-    return packet;
+    /* return the header length */
+    return p - header;
+}
+
+/* romLoadSize - number of bytes sent to the ROM boot loader to load an image including the handshake response
+   templates or -1 if the image can't be encoded */
+int SerialPropConnection::romLoadSize(const uint8_t *image, int imageSize, LoadType loadType)
+{
+    uint8_t encoded[PDS_MAX_ENCODED_SIZE(ENCODE_CHUNK_SIZE)];
+    int size, chunkSize, cnt, i;
+    PDSEncoder encoder;
+    
+    if ((size = GenerateLoaderHeader(imageSize, loadType, encoded)) < 0)
+        return -1;
+    
+    PDSEncodeInit(&encoder);
+    for (i = 0; i < imageSize; i += chunkSize) {
+        if ((chunkSize = imageSize - i) > ENCODE_CHUNK_SIZE)
+            chunkSize = ENCODE_CHUNK_SIZE;
+        if ((cnt = PDSEncodeChunk(&encoder, image + i, chunkSize, encoded, sizeof(encoded))) < 0)
+            return -1;
+        size += cnt;
+    }
+    if ((cnt = PDSEncodeEnd(&encoder, encoded, sizeof(encoded))) < 0)
+        return -1;
+    
+    return size + cnt + sizeof(rxHandshake) + 4;
+}
+
+/* sendLoaderPacket - send the loader packet encoding the image as it goes so the handshake goes out at once;
+   returns the number of bytes sent or -1 */
+int SerialPropConnection::sendLoaderPacket(const uint8_t *image, int imageSize, LoadType loadType)
+{
+    uint8_t buffer[PDS_MAX_ENCODED_SIZE(ENCODE_CHUNK_SIZE)];
+    int size, chunkSize, cnt, i;
+    PDSEncoder encoder;
+    
+    /* send the handshake, command and image length */
+    if ((cnt = GenerateLoaderHeader(imageSize, loadType, buffer)) < 0 || sendData(buffer, cnt) != cnt)
+        return -1;
+    size = cnt;
+    
+    /* send the image encoded a chunk at a time; the serial port drains each chunk while the next is encoded */
+    PDSEncodeInit(&encoder);
+    for (i = 0; i < imageSize; i += chunkSize) {
+        if ((chunkSize = imageSize - i) > ENCODE_CHUNK_SIZE)
+            chunkSize = ENCODE_CHUNK_SIZE;
+        if ((cnt = PDSEncodeChunk(&encoder, image + i, chunkSize, buffer, sizeof(buffer))) < 0 || sendData(buffer, cnt) != cnt)
+            return -1;
+        size += cnt;
+    }
+    if ((cnt = PDSEncodeEnd(&encoder, buffer, sizeof(buffer))) < 0 || sendData(buffer, cnt) != cnt)
+        return -1;
+    
+    /* return the number of bytes sent */
+    return size + cnt;
 }
 
 int SerialPropConnection::identify(int *pVersion)
 {
-    uint8_t packet2[MAX_BUFFER_SIZE]; // must be at least as big as maxDataSize()
+    uint8_t packet2[MAX_BUFFER_SIZE]; // must be at least as big as VERIFY_TEMPLATE_COUNT
     int version, cnt, i;
     uint8_t *packet;
     int packetSize;
@@ -287,8 +241,8 @@ int SerialPropConnection::identify(int *pVersion)
     sendData(packet, packetSize);
     
     /* send the verification packet (all timing templates) */
-    memset(packet2, 0xF9, maxDataSize());
-    sendData(packet2, maxDataSize());
+    memset(packet2, 0xF9, VERIFY_TEMPLATE_COUNT);
+    sendData(packet2, VERIFY_TEMPLATE_COUNT);
     
     /* receive the handshake response and the hardware version */
     cnt = receiveDataExactTimeout(packet2, sizeof(rxHandshake) + 4, 2000);
@@ -328,17 +282,16 @@ int SerialPropConnection::loadImage(const uint8_t *image, int imageSize, uint8_t
     return receiveDataExactTimeout(response, responseSize, 1000) == responseSize ? 0 : -2;
 }
 
-#define ACK_POLLING_INTERVAL        10
-#define RAM_PROGRAMMING_RETRIES     (10000 / ACK_POLLING_INTERVAL)
-#define EEPROM_PROGRAMMING_RETRIES  (5000 / ACK_POLLING_INTERVAL)
-#define EEPROM_VERIFY_RETRIES       (2000 / ACK_POLLING_INTERVAL)
+#define RAM_PROGRAMMING_TIMEOUT     10000
+#define EEPROM_PROGRAMMING_TIMEOUT  5000
+#define EEPROM_VERIFY_TIMEOUT       2000
 
 int SerialPropConnection::loadImage(const uint8_t *image, int imageSize, LoadType loadType, int info)
 {
-    uint8_t packet2[MAX_BUFFER_SIZE]; // must be at least as big as maxDataSize()
-    int packetSize, version, retries, cnt, i;
+    uint8_t packet2[sizeof(rxHandshake) + 4];
+    int packetSize, version, cnt, i;
     int loaderBaudRate;
-    uint8_t *packet;
+    int64_t phaseStart;
     
     if (!GetNumericConfigField(config(), "loader-baud-rate", &loaderBaudRate))
         loaderBaudRate = DEF_LOADER_BAUDRATE;
@@ -349,22 +302,21 @@ int SerialPropConnection::loadImage(const uint8_t *image, int imageSize, LoadTyp
         return -1;
     }
         
-    /* generate a loader packet */
-    if (!(packet = GenerateLoaderPacket(image, imageSize, &packetSize, loadType))) {
-        nerror(ERROR_INTERNAL_CODE_ERROR);
-        return -1;
-    }
-
     /* reset the Propeller */
+    phaseStart = LoadTraceTime();
     generateResetSignal();
+    LoadTracePhase("reset", phaseStart, 0, loaderBaudRate);
     
     /* send the packet including the image */
     if (info)
         nmessage(INFO_DOWNLOADING, portName());
-    sendData(packet, packetSize);
+    phaseStart = LoadTraceTime();
+    if ((packetSize = sendLoaderPacket(image, imageSize, loadType)) < 0) {
+        nmessage(ERROR_COMMUNICATION_LOST);
+        return -1;
+    }
     if (info)
         nmessage(INFO_BYTES_SENT, (long)imageSize);
-    free(packet);
     
     /* clock out the handshake response */
     memset(packet2, 0xF9, sizeof(rxHandshake) + 4);
@@ -387,82 +339,74 @@ int SerialPropConnection::loadImage(const uint8_t *image, int imageSize, LoadTyp
         nmessage(ERROR_WRONG_PROPELLER_VERSION, version);
         return -1;
     }
+    LoadTracePhase("rom-download", phaseStart, packetSize, loaderBaudRate);
     
     if (info)
         nmessage(INFO_VERIFYING_RAM);
+    phaseStart = LoadTraceTime();
 
-    /* receive the RAM verify response */
-    packet2[0] = 0xF9;
-    retries = RAM_PROGRAMMING_RETRIES;
-    do {
-        sendData(packet2, 1);
-        cnt = receiveDataExactTimeout(packet2, 1, 10);
-    } while (cnt <= 0 && --retries > 0);
+    /* receive the RAM verify response (the handshake reply can arrive while the image is still going out) */
+    cnt = receiveChecksumAck(packetSize + sizeof(packet2), RAM_PROGRAMMING_TIMEOUT);
 
     /* check for timeout */
-    if (cnt <= 0) {
+    if (cnt < 0) {
         nmessage(ERROR_COMMUNICATION_LOST);
         return -1;
     }
     
     /* verify the checksum response */
-    if (packet2[0] != 0xFE) {
-        //message("RAM checksum failed: expected 0xFE, got %02x", packet2[0]);
+    if (cnt != 0xFE) {
+        //message("RAM checksum failed: expected 0xFE, got %02x", cnt);
         nmessage(ERROR_RAM_CHECKSUM_FAILED);
         return -1;
     }
+    LoadTracePhase("rom-verify-ram", phaseStart, 0, loaderBaudRate);
     
     /* handle EEPROM programming */
     if (loadType == ltDownloadAndProgram || loadType == ltDownloadAndProgramAndRun) {
     
         if (info)
             nmessage(INFO_PROGRAMMING_EEPROM);
+        phaseStart = LoadTraceTime();
 
         /* receive the EEPROM programming complete response */
-        packet2[0] = 0xF9;
-        retries = EEPROM_PROGRAMMING_RETRIES;
-        do {
-            sendData(packet2, 1);
-            cnt = receiveDataExactTimeout(packet2, 1, 10);
-        } while (cnt <= 0 && --retries > 0);
+        cnt = receiveChecksumAck(0, EEPROM_PROGRAMMING_TIMEOUT);
 
         /* check for timeout */
-        if (cnt <= 0) {
+        if (cnt < 0) {
             nmessage(ERROR_COMMUNICATION_LOST);
             return -1;
         }
     
         /* verify the checksum response */
-        if (packet2[0] != 0xFE) {
-            //message("EEPROM checksum failed: expected 0xFE, got %02x", packet2[0]);
+        if (cnt != 0xFE) {
+            //message("EEPROM checksum failed: expected 0xFE, got %02x", cnt);
             nmessage(ERROR_EEPROM_CHECKSUM_FAILED);
             return -1;
         }
+        LoadTracePhase("rom-program-eeprom", phaseStart, 0, loaderBaudRate);
     
         if (info)
             nmessage(INFO_VERIFYING_EEPROM);
+        phaseStart = LoadTraceTime();
 
         /* receive the EEPROM verify response */
-        packet2[0] = 0xF9;
-        retries = EEPROM_VERIFY_RETRIES;
-        do {
-            sendData(packet2, 1);
-            cnt = receiveDataExactTimeout(packet2, 1, 10);
-        } while (cnt <= 0 && --retries > 0);
+        cnt = receiveChecksumAck(0, EEPROM_VERIFY_TIMEOUT);
 
         /* check for timeout */
-        if (cnt <= 0) {
+        if (cnt < 0) {
             message("Timeout waiting for checksum");
             nmessage(ERROR_COMMUNICATION_LOST);
             return -1;
         }
     
         /* verify the checksum response */
-        if (packet2[0] != 0xFE) {
-            //message("EEPROM verify failed: expected 0xFE, got %02x", packet2[0]);
+        if (cnt != 0xFE) {
+            //message("EEPROM verify failed: expected 0xFE, got %02x", cnt);
             nmessage(ERROR_EEPROM_VERIFY_FAILED);
             return -1;
         }
+        LoadTracePhase("rom-verify-eeprom", phaseStart, 0, loaderBaudRate);
     }
        
     /* return successfully */
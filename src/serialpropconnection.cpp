@@ -1,8 +1,19 @@
 #include <stdio.h>
+#include <new>
+#include <pthread.h>
 #include "serialpropconnection.h"
 #include "messages.h"
+#include "proploader.h"
+#include "system.h"
 
-#define CALIBRATE_DELAY         10
+// Milliseconds of timing templates sent at a time while waiting for the ROM boot loader to respond to a checksum.
+// Templates still queued when the response arrives are discarded but those already in the UART reach the Propeller
+// after it has moved on (the second-stage loader waits for a resting line before it starts) so the burst is kept short.
+#define ACK_BURST_TIME          1
+#define ACK_MAX_BURST           64
+
+// number of consecutive resets that must reach the ROM boot loader before a reset timing is accepted
+#define RESET_CALIBRATION_TRIALS    3
 
 SerialPropConnection::SerialPropConnection()
     : m_serialPort(NULL)
@@ -32,12 +43,78 @@ int SerialPropConnection::addPort(const char *port, void *data)
     return state->count < 0 || --state->count > 0;
 }
 
-int SerialPropConnection::findPorts(bool check, SerialInfoList &list, int count)
+// a port being checked for a Propeller
+struct ProbeState {
+    SerialInfo *info;
+    const char *resetMethod;
+    int resetPulseTime;     // reset pulse and settle times in milliseconds (-1 selects the default)
+    int resetSettleTime;
+    int version;            // Propeller version or -1 if none answered
+    pthread_t thread;
+    bool threaded;
+};
+
+/* probePort - reset and identify the Propeller on a port (the body of a port probe thread) */
+void *SerialPropConnection::probePort(void *data)
+{
+    ProbeState *probe = (ProbeState *)data;
+    SerialPropConnection connection;
+    int version;
+    
+    probe->version = -1;
+    if (connection.open(probe->info->port(), DEF_LOADER_BAUDRATE) != 0)
+        return NULL;
+    connection.setResetTiming(probe->resetPulseTime, probe->resetSettleTime);
+    if ((!probe->resetMethod || connection.setResetMethod(probe->resetMethod) == 0) && connection.identify(&version) == 0)
+        probe->version = version;
+    connection.close();
+    
+    return NULL;
+}
+
+/* findPorts - find serial ports and, if check is true, keep only those with a Propeller attached
+
+   Checking resets and identifies the Propeller on every port at once so it takes about as long as checking one port.
+*/
+int SerialPropConnection::findPorts(bool check, SerialInfoList &list, int count, const char *resetMethod, int resetPulseTime, int resetSettleTime)
 {
+    SerialInfoList::iterator i;
+    ProbeState *probes;
     FindState state;
+    int n;
+    
     state.list = &list;
-    state.count = count;
+    state.count = check ? -1 : count;
     SerialFind(addPort, &state);
+    if (!check || list.empty())
+        return 0;
+    
+    /* probe all of the ports in parallel */
+    if (!(probes = new (std::nothrow) ProbeState[list.size()]))
+        return -1;
+    for (i = list.begin(), n = 0; i != list.end(); ++i, ++n) {
+        probes[n].info = &*i;
+        probes[n].resetMethod = resetMethod;
+        probes[n].resetPulseTime = resetPulseTime;
+        probes[n].resetSettleTime = resetSettleTime;
+        probes[n].threaded = pthread_create(&probes[n].thread, NULL, probePort, &probes[n]) == 0;
+        if (!probes[n].threaded)
+            probePort(&probes[n]);
+    }
+    
+    /* keep the ports that answered in the order they were found */
+    for (i = list.begin(), n = 0; i != list.end(); ++n) {
+        if (probes[n].threaded)
+            pthread_join(probes[n].thread, NULL);
+        if (probes[n].version >= 0 && (count < 0 || count-- > 0)) {
+            i->setVersion(probes[n].version);
+            ++i;
+        }
+        else
+            i = list.erase(i);
+    }
+    delete[] probes;
+    
     return 0;
 }
 
@@ -96,6 +173,95 @@ int SerialPropConnection::generateResetSignal()
     return 0;
 }
 
+/* setResetTiming - set the reset pulse and settle times in milliseconds (-1 selects the default) */
+int SerialPropConnection::setResetTiming(int pulseTime, int settleTime)
+{
+    if (!isOpen())
+        return -1;
+    SerialSetResetTiming(m_serialPort, pulseTime, settleTime);
+    return 0;
+}
+
+/* setReaderThread - start or stop a thread that reads the port in the background */
+int SerialPropConnection::setReaderThread(bool enable)
+{
+    if (!isOpen())
+        return -1;
+    if (!enable)
+        SerialStopReader(m_serialPort);
+    else if (SerialStartReader(m_serialPort) != 0)
+        return -1;
+    return 0;
+}
+
+/* resetWorks - check that a reset timing reliably brings up the ROM boot loader */
+bool SerialPropConnection::resetWorks(int pulseTime, int settleTime)
+{
+    int version, i;
+    SerialSetResetTiming(m_serialPort, pulseTime, settleTime);
+    for (i = 0; i < RESET_CALIBRATION_TRIALS; ++i) {
+        if (identify(&version) != 0)
+            return false;
+    }
+    return true;
+}
+
+/* calibrateReset - find the shortest reset pulse and settle times that work with the attached board
+ 
+   Each time is found with a binary search that starts from the default timing, first for the pulse and then for the
+   settle time with the pulse already shortened. The results include a margin over the shortest times that worked and
+   are left selected on the port. Returns -1 if the board can't be reset even with the default timing.
+*/
+int SerialPropConnection::calibrateReset(int *pPulseTime, int *pSettleTime)
+{
+    int defPulseTime, defSettleTime, lo, hi, mid;
+    
+    if (!isOpen())
+        return -1;
+    
+    /* start from the default timing */
+    SerialSetResetTiming(m_serialPort, -1, -1);
+    SerialGetResetTiming(m_serialPort, &defPulseTime, &defSettleTime);
+    if (!resetWorks(defPulseTime, defSettleTime))
+        return -1;
+    
+    /* find the shortest reset pulse */
+    lo = 1; hi = defPulseTime;
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (resetWorks(mid, defSettleTime))
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    *pPulseTime = hi + hi / 2 + 2;
+    if (*pPulseTime > defPulseTime)
+        *pPulseTime = defPulseTime;
+    
+    /* find the shortest settle time after releasing the reset line */
+    lo = 0; hi = defSettleTime;
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (resetWorks(*pPulseTime, mid))
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    *pSettleTime = hi + hi / 2 + 2;
+    if (*pSettleTime > defSettleTime)
+        *pSettleTime = defSettleTime;
+    
+    SerialSetResetTiming(m_serialPort, *pPulseTime, *pSettleTime);
+    return 0;
+}
+
+/* defaultRoundTripTime - estimate the round trip time from the adapter's latency timer if it has one */
+int SerialPropConnection::defaultRoundTripTime()
+{
+    int latency = receiveLatency();
+    return latency >= 0 ? latency * 1000 + SERIAL_TURNAROUND_TIME : SERIAL_ROUND_TRIP_TIME;
+}
+
 int SerialPropConnection::sendData(const uint8_t *buf, int len)
 {
     if (!isOpen())
@@ -103,6 +269,13 @@ int SerialPropConnection::sendData(const uint8_t *buf, int len)
     return SendSerialData(m_serialPort, buf, len);
 }
 
+int SerialPropConnection::sendDataV(const struct iovec *iov, int count)
+{
+    if (!isOpen())
+        return -1;
+    return SendSerialDataV(m_serialPort, iov, count);
+}
+
 int SerialPropConnection::receiveDataTimeout(uint8_t *buf, int len, int timeout)
 {
     if (!isOpen())
@@ -117,20 +290,49 @@ int SerialPropConnection::receiveDataExactTimeout(uint8_t *buf, int len, int tim
     return ReceiveSerialDataExactTimeout(m_serialPort, buf, len, timeout);
 }
 
-int SerialPropConnection::receiveChecksumAck(int byteCount, int delay)
+int SerialPropConnection::receiveDataExactDeadline(uint8_t *buf, int len, int64_t deadline)
+{
+    if (!isOpen())
+        return -1;
+    return ReceiveSerialDataExactDeadline(m_serialPort, buf, len, deadline);
+}
+
+/* receiveChecksumAck - clock out the ROM boot loader's response to a checksum
+
+   Up to byteCount bytes may still be on their way to the Propeller; they go out before any templates and then the
+   Propeller may take up to timeout milliseconds to respond.  Timing templates are sent in bursts of ACK_BURST_TIME
+   with the next burst sent as the last one finishes going out so the read returns as soon as the response arrives.
+
+   returns the response (0xFE for a good checksum) or -1 if there was none
+*/
+int SerialPropConnection::receiveChecksumAck(int byteCount, int timeout)
 {
-    static uint8_t calibrate[1] = { 0xF9 };
-    int msSendTime = (byteCount * 10 * 1000) / m_baudRate;
-    int retries = (msSendTime / CALIBRATE_DELAY) | (delay / CALIBRATE_DELAY);
-    uint8_t buf[1];
-    int cnt;
+    uint8_t templates[ACK_MAX_BURST], buf[1];
+    int burst, burstTime, sendTime;
+    int64_t deadline;
+
+    /* send as many templates at a time as go out in ACK_BURST_TIME */
+    if ((burst = m_baudRate * ACK_BURST_TIME / (10 * 1000)) < 1)
+        burst = 1;
+    else if (burst > ACK_MAX_BURST)
+        burst = ACK_MAX_BURST;
+    memset(templates, 0xF9, burst);
+    burstTime = (burst * 10 * 1000 + m_baudRate - 1) / m_baudRate;
+    sendTime = (int)((int64_t)byteCount * 10 * 1000 / m_baudRate);
+
+    deadline = xbMonotonicMicros() + (int64_t)(sendTime + timeout) * 1000;
+
+    /* let what's already queued go out so each burst's read times out as that burst finishes */
+    FlushSerialData(m_serialPort);
 
     do {
-        sendData(calibrate, sizeof(calibrate));
-        cnt = receiveDataExactTimeout(buf, 1, CALIBRATE_DELAY);
-        if (cnt == 1)
-            return buf[0] == 0xFE ? 0 : -1;
-    } while (--retries >= 0);
+        if (sendData(templates, burst) != burst)
+            return -1;
+        if (receiveDataExactTimeout(buf, 1, burstTime) == 1) {
+            DiscardSerialOutput(m_serialPort);
+            return buf[0];
+        }
+    } while (xbMonotonicMicros() < deadline);
 
     return -1;
 }
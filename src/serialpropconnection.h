@@ -8,15 +8,31 @@
 
 class SerialInfo {
 public:
-    SerialInfo() {}
-    SerialInfo(std::string port) : m_port(port) {}
+    SerialInfo() : m_version(0) {}
+    SerialInfo(std::string port) : m_port(port), m_version(0) {}
     const char *port() { return m_port.c_str(); }
+    int version() { return m_version; }     // Propeller version (only set by a checked findPorts)
+    void setVersion(int version) { m_version = version; }
 private:
     std::string m_port;
+    int m_version;
 };
 
 typedef std::list<SerialInfo> SerialInfoList;
 
+// a serial link doesn't frame packets so their size is only limited by the loader receiving them
+#define SERIAL_MAX_DATA_SIZE    4096
+
+// the ROM boot loader can load all of hub RAM over a serial link
+#define SERIAL_MAX_ROM_IMAGE_SIZE   32768
+
+// typical round trip latency in microseconds before one has been measured; a USB serial adapter holds short replies
+// for its latency timer (16ms by default on FTDI parts)
+#define SERIAL_ROUND_TRIP_TIME  16000
+
+// round trip time in microseconds on top of the latency timer when that is known (USB polling and turnaround)
+#define SERIAL_TURNAROUND_TIME  1000
+
 class SerialPropConnection : public PropConnection
 {
 public:
@@ -29,19 +45,32 @@ public:
     int disconnect();
     int setResetMethod(const char *method);
     int generateResetSignal();
+    int setResetTiming(int pulseTime, int settleTime);
+    int setReaderThread(bool enable);
+    int calibrateReset(int *pPulseTime, int *pSettleTime);
     int identify(int *pVersion);
     int loadImage(const uint8_t *image, int imageSize, uint8_t *response, int responseSize);
     int loadImage(const uint8_t *image, int imageSize, LoadType loadType = ltDownloadAndRun, int info = false);
     int sendData(const uint8_t *buf, int len);
+    int sendDataV(const struct iovec *iov, int count);
     int receiveDataTimeout(uint8_t *buf, int len, int timeout);
     int receiveDataExactTimeout(uint8_t *buf, int len, int timeout);
+    int receiveDataExactDeadline(uint8_t *buf, int len, int64_t deadline);
     int setBaudRate(int baudRate);
-    int maxDataSize() { return 1024; }
+    bool baudRateSupported(int baudRate) { return SerialBaudRateSupported(baudRate) != 0; }
+    int maxDataSize() { return SERIAL_MAX_DATA_SIZE; }
+    int maxRomImageSize() { return SERIAL_MAX_ROM_IMAGE_SIZE; }
+    int defaultRoundTripTime();
+    int receiveLatency() { return m_serialPort ? SerialGetLatency(m_serialPort) : -1; }
     int terminal(bool checkForExit, bool pstMode);
-    static int findPorts(bool check, SerialInfoList &list, int count = -1);
+    static int findPorts(bool check, SerialInfoList &list, int count = -1, const char *resetMethod = NULL, int resetPulseTime = -1, int resetSettleTime = -1);
+    static int romLoadSize(const uint8_t *image, int imageSize, LoadType loadType);
 private:
-    int receiveChecksumAck(int byteCount, int delay);
+    int sendLoaderPacket(const uint8_t *image, int imageSize, LoadType loadType);
+    int receiveChecksumAck(int byteCount, int timeout);
+    bool resetWorks(int pulseTime, int settleTime);
     static int addPort(const char *port, void *data);
+    static void *probePort(void *data);
     SERIAL *m_serialPort;
 };
 
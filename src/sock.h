@@ -14,6 +14,7 @@ typedef unsigned long in_addr_t;
 
 /* for linux and mac builds */
 #else
+#include <stdint.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/select.h>
@@ -32,26 +33,43 @@ typedef int SOCKET;
 #define INVALID_SOCKET  -1
 #endif
 
+/* defined in system.h */
+struct iovec;
+
 typedef struct {
     SOCKADDR_IN addr;
     SOCKADDR_IN mask;
     SOCKADDR_IN bcast;
 } IFADDR;
 
+/* TCP options for a connection (zero leaves the system's setting); the buffer sizes are set by ConnectSocket and
+   ConnectSocketTimeout before connecting so the receive window scale can allow for them */
+typedef struct {
+    int noDelay;            /* send small writes at once instead of waiting for earlier data to be acknowledged */
+    int quickAck;           /* acknowledge received data at once (Linux only; see SocketQuickAck) */
+    int sendBufferSize;     /* bytes */
+    int receiveBufferSize;  /* bytes */
+    int keepAlive;          /* seconds idle before probing the connection */
+} SOCKET_PROFILE;
+
 int GetInterfaceAddresses(IFADDR *addrs, int max);
 int GetInternetAddress(const char *hostName, short port, SOCKADDR_IN *addr);
 const char *AddrToString(uint32_t addr);
 int StringToAddr(const char *addr, uint32_t *pAddr);
 int OpenBroadcastSocket(short port, SOCKET *pSocket);
-int ConnectSocket(SOCKADDR_IN *addr, SOCKET *pSocket);
-int ConnectSocketTimeout(SOCKADDR_IN *addr, int timeout, SOCKET *pSocket);
+int ConnectSocket(SOCKADDR_IN *addr, const SOCKET_PROFILE *profile, SOCKET *pSocket);
+int ConnectSocketTimeout(SOCKADDR_IN *addr, int timeout, const SOCKET_PROFILE *profile, SOCKET *pSocket);
 int BindSocket(short port, SOCKET *pSocket);
 void CloseSocket(SOCKET sock);
+int SetSocketProfile(SOCKET sock, const SOCKET_PROFILE *profile);
+int SocketQuickAck(SOCKET sock);
 int SocketDataAvailableP(SOCKET sock, int timeout);
 int SendSocketData(SOCKET sock, const void *buf, int len);
+int SendSocketDataV(SOCKET sock, const struct iovec *iov, int count);
 int ReceiveSocketData(SOCKET sock, void *buf, int len);
 int ReceiveSocketDataTimeout(SOCKET sock, void *buf, int len, int timeout);
 int ReceiveSocketDataExactTimeout(SOCKET sock, void *buf, int len, int timeout);
+int ReceiveSocketDataExactDeadline(SOCKET sock, void *buf, int len, int64_t deadline);
 int SendSocketDataTo(SOCKET sock, const void *buf, int len, SOCKADDR_IN *addr);
 int ReceiveSocketDataFrom(SOCKET sock, void *buf, int len, SOCKADDR_IN *addr);
 int ReceiveSocketDataAndAddress(SOCKET sock, void *buf, int len, SOCKADDR_IN *addr);
@@ -15,6 +15,14 @@
 #endif
 
 #include "sock.h"
+#include "proploader.h"
+#include "system.h"
+#ifndef __MINGW32__
+#include "ioready.h"
+#endif
+#ifdef LINUX
+#include "iouring.h"
+#endif
 
 #ifdef __MINGW32__
 
@@ -68,6 +76,48 @@ int GetInternetAddress(const char *hostName, short port, SOCKADDR_IN *addr)
     return 0;
 }
 
+#ifdef __MINGW32__
+#define IO_READ     1
+#define IO_WRITE    2
+
+/* most buffers SendSocketDataV can pass to winsock at once */
+#define SEND_VECTOR_MAX 16
+#endif
+
+/* WaitSocket - wait up to timeout milliseconds (forever if negative) for a socket to be readable or writable
+
+   returns the ready events, 0 on a timeout or -1 on an error
+*/
+static int WaitSocket(SOCKET sock, int events, int timeout)
+{
+#ifdef __MINGW32__
+    /* winsock socket sets are lists so select has no descriptor limit */
+    struct timeval timeVal;
+    fd_set sockets;
+    int cnt;
+
+    FD_ZERO(&sockets);
+    FD_SET(sock, &sockets);
+
+    timeVal.tv_sec = timeout / 1000;
+    timeVal.tv_usec = (timeout % 1000) * 1000;
+
+    cnt = select(sock + 1, (events & IO_READ) ? &sockets : NULL, (events & IO_WRITE) ? &sockets : NULL, NULL,
+                 timeout < 0 ? NULL : &timeVal);
+    return cnt > 0 && FD_ISSET(sock, &sockets) ? events : cnt;
+#else
+    return IoReadyWait(sock, events, timeout);
+#endif
+}
+
+/* RegisterSocket - register a new socket for waiting on */
+static void RegisterSocket(SOCKET sock)
+{
+#ifndef __MINGW32__
+    IoReadyRegister(sock);
+#endif
+}
+
 /* OpenBroadcastSocket - open a broadcast socket */
 int OpenBroadcastSocket(short port, SOCKET *pSocket)
 {
@@ -103,12 +153,39 @@ int OpenBroadcastSocket(short port, SOCKET *pSocket)
     }
 
     /* return the socket */
+    RegisterSocket(sock);
     *pSocket = sock;
     return 0;
 }
 
-/* ConnectSocket - connect to a server */
-int ConnectSocket(SOCKADDR_IN *addr, SOCKET *pSocket)
+/* SetSocketBufferSizes - set the buffer sizes in a profile (if there is one) on a socket that isn't connected yet
+
+   returns 0 or -1 if a size couldn't be set
+*/
+static int SetSocketBufferSizes(SOCKET sock, const SOCKET_PROFILE *profile)
+{
+    int sts = 0, value;
+
+    if (!profile)
+        return 0;
+
+    if (profile->sendBufferSize > 0) {
+        value = profile->sendBufferSize;
+        if (setsockopt(sock, SOL_SOCKET, SO_SNDBUF, (char *)&value, sizeof(value)) != 0)
+            sts = -1;
+    }
+
+    if (profile->receiveBufferSize > 0) {
+        value = profile->receiveBufferSize;
+        if (setsockopt(sock, SOL_SOCKET, SO_RCVBUF, (char *)&value, sizeof(value)) != 0)
+            sts = -1;
+    }
+
+    return sts;
+}
+
+/* ConnectSocket - connect to a server setting the buffer sizes in profile first (profile may be NULL) */
+int ConnectSocket(SOCKADDR_IN *addr, const SOCKET_PROFILE *profile, SOCKET *pSocket)
 {
     SOCKET sock;
     
@@ -121,6 +198,9 @@ int ConnectSocket(SOCKADDR_IN *addr, SOCKET *pSocket)
     if ((sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0)
         return -1;
 
+    /* size its buffers (a size the system won't take isn't fatal) */
+    SetSocketBufferSizes(sock, profile);
+
     /* connect to the server */
     if (connect(sock, (SOCKADDR *)addr, sizeof(*addr)) != 0) {
         closesocket(sock);
@@ -128,15 +208,17 @@ int ConnectSocket(SOCKADDR_IN *addr, SOCKET *pSocket)
     }
 
     /* return the socket */
+    RegisterSocket(sock);
     *pSocket = sock;
     return 0;
 }
 
-/* ConnectSocketTimeout - connect to a server with a timeout */
-int ConnectSocketTimeout(SOCKADDR_IN *addr, int timeout, SOCKET *pSocket)
+/* ConnectSocketTimeout - connect to a server with a timeout setting the buffer sizes in profile first (profile may be
+   NULL) */
+int ConnectSocketTimeout(SOCKADDR_IN *addr, int timeout, const SOCKET_PROFILE *profile, SOCKET *pSocket)
 {
 #ifdef __MINGW32__
-    return ConnectSocket(addr, pSocket);
+    return ConnectSocket(addr, profile, pSocket);
 #else
     int flags, err;
     SOCKET sock;
@@ -150,6 +232,9 @@ int ConnectSocketTimeout(SOCKADDR_IN *addr, int timeout, SOCKET *pSocket)
     if ((sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0)
         return -1;
 
+    /* size its buffers (a size the system won't take isn't fatal) */
+    SetSocketBufferSizes(sock, profile);
+
     /* set the socket to non-blocking mode */
     flags = fcntl(sock, F_GETFL, 0);
     if (fcntl(sock, F_SETFL, flags | O_NONBLOCK) != 0) {
@@ -159,9 +244,7 @@ int ConnectSocketTimeout(SOCKADDR_IN *addr, int timeout, SOCKET *pSocket)
 
     /* connect to the server */
     if (connect(sock, (SOCKADDR *)addr, sizeof(*addr)) != 0) {
-        struct timeval timeVal;
         socklen_t optLen;
-        fd_set sockets;
             
         /* fail on any error other than "in progress" */
         if (errno != EINPROGRESS) {
@@ -169,16 +252,8 @@ int ConnectSocketTimeout(SOCKADDR_IN *addr, int timeout, SOCKET *pSocket)
             return -1;
         }
         
-        /* setup the read socket set */
-        FD_ZERO(&sockets);
-        FD_SET(sock, &sockets);
-
-        /* setup the timeout */
-        timeVal.tv_sec = timeout / 1000;
-        timeVal.tv_usec = (timeout % 1000) * 1000;
-
         /* wait for the connect to complete or a timeout */
-        if (select(sock + 1, NULL, &sockets, NULL, &timeVal) <= 0 || !FD_ISSET(sock, &sockets)) {
+        if (WaitSocket(sock, IO_WRITE, timeout) <= 0) {
             closesocket(sock);
             return -1;
         }
@@ -198,6 +273,7 @@ int ConnectSocketTimeout(SOCKADDR_IN *addr, int timeout, SOCKET *pSocket)
     }
 
     /* return the socket */
+    RegisterSocket(sock);
     *pSocket = sock;
     return 0;
 #endif
@@ -231,6 +307,7 @@ int BindSocket(short port, SOCKET *pSocket)
     }
 
     /* return the socket */
+    RegisterSocket(sock);
     *pSocket = sock;
     return 0;
 }
@@ -238,57 +315,118 @@ int BindSocket(short port, SOCKET *pSocket)
 /* CloseSocket - close a socket */
 void CloseSocket(SOCKET sock)
 {
-    struct timeval tv;
-    fd_set sockets;
     char buf[512];
 
-    tv.tv_sec = 0;
-    tv.tv_usec = 1000;
-
     /* wait for the close to complete */
     for (;;) {
-        FD_ZERO(&sockets);
-        FD_SET(sock, &sockets);
-        if (select(sock + 1, &sockets, NULL, NULL, &tv) > 0) {
-            if (FD_ISSET(sock, &sockets))
-                if (recv(sock, buf, sizeof(buf), 0) == 0)
-                    break;
+        if (WaitSocket(sock, IO_READ, 1) > 0) {
+            if (recv(sock, buf, sizeof(buf), 0) == 0)
+                break;
         }
         else
             break;
     }
 
     /* close the socket */
+#ifndef __MINGW32__
+    IoReadyUnregister(sock);
+#endif
     closesocket(sock);
 }
 
-/* SocketDataAvailableP - check for data being available on a socket */
-int SocketDataAvailableP(SOCKET sock, int timeout)
+/* SetSocketProfile - apply TCP options other than the buffer sizes to a connected socket (ones the system doesn't
+   have are skipped)
+
+   returns 0 or -1 if an option couldn't be set
+*/
+int SetSocketProfile(SOCKET sock, const SOCKET_PROFILE *profile)
 {
-    struct timeval timeVal;
-    fd_set sockets;
-    int cnt;
+    int sts = 0, value;
 
-    /* setup the read socket set */
-    FD_ZERO(&sockets);
-    FD_SET(sock, &sockets);
+    if (profile->noDelay) {
+        value = 1;
+        if (setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (char *)&value, sizeof(value)) != 0)
+            sts = -1;
+    }
 
-    timeVal.tv_sec = timeout / 1000;
-    timeVal.tv_usec = (timeout % 1000) * 1000;
+    if (profile->quickAck && SocketQuickAck(sock) != 0)
+        sts = -1;
+
+    if (profile->keepAlive > 0) {
+        value = 1;
+        if (setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, (char *)&value, sizeof(value)) != 0)
+            sts = -1;
+        value = profile->keepAlive;
+#if defined(TCP_KEEPIDLE)
+        if (setsockopt(sock, IPPROTO_TCP, TCP_KEEPIDLE, (char *)&value, sizeof(value)) != 0
+        ||  setsockopt(sock, IPPROTO_TCP, TCP_KEEPINTVL, (char *)&value, sizeof(value)) != 0)
+            sts = -1;
+#elif defined(TCP_KEEPALIVE)
+        if (setsockopt(sock, IPPROTO_TCP, TCP_KEEPALIVE, (char *)&value, sizeof(value)) != 0)
+            sts = -1;
+#endif
+    }
+
+    return sts;
+}
 
-    /* check for data available */
-    cnt = select(sock + 1, &sockets, NULL, NULL, timeout < 0 ? NULL : &timeVal);
+/* SocketQuickAck - acknowledge received data at once; Linux drops back to delaying acknowledgements on its own so
+   this has to be repeated after each receive */
+int SocketQuickAck(SOCKET sock)
+{
+#ifdef TCP_QUICKACK
+    int value = 1;
+    return setsockopt(sock, IPPROTO_TCP, TCP_QUICKACK, (char *)&value, sizeof(value));
+#else
+    return 0;
+#endif
+}
 
-    /* return whether data is available */
-    return cnt > 0 && FD_ISSET(sock, &sockets);
+/* SocketDataAvailableP - check for data being available on a socket */
+int SocketDataAvailableP(SOCKET sock, int timeout)
+{
+    return WaitSocket(sock, IO_READ, timeout) > 0;
 }
 
 /* SendSocketData - send socket data */
 int SendSocketData(SOCKET sock, const void *buf, int len)
 {
+#ifdef LINUX
+    if (IoUringEnabled())
+        return IoUringWrite(sock, buf, len);
+#endif
     return send(sock, buf, len, 0);
 }
 
+/* SendSocketDataV - send a scatter-gather list with one system call */
+int SendSocketDataV(SOCKET sock, const struct iovec *iov, int count)
+{
+#ifdef __MINGW32__
+    WSABUF bufs[SEND_VECTOR_MAX];
+    DWORD sent;
+    int i;
+
+    if (count > SEND_VECTOR_MAX)
+        return -1;
+    for (i = 0; i < count; ++i) {
+        bufs[i].buf = (char *)iov[i].iov_base;
+        bufs[i].len = (ULONG)iov[i].iov_len;
+    }
+    return WSASend(sock, bufs, count, &sent, 0, NULL, NULL) == 0 ? (int)sent : -1;
+#else
+    struct msghdr msg;
+
+#ifdef LINUX
+    if (IoUringEnabled())
+        return IoUringWriteV(sock, iov, count);
+#endif
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = (struct iovec *)iov;
+    msg.msg_iovlen = count;
+    return (int)sendmsg(sock, &msg, 0);
+#endif
+}
+
 /* SendSocketDataTo - send socket data to a specified address */
 int SendSocketDataTo(SOCKET sock, const void *buf, int len, SOCKADDR_IN *addr)
 {
@@ -298,35 +436,41 @@ int SendSocketDataTo(SOCKET sock, const void *buf, int len, SOCKADDR_IN *addr)
 /* ReceiveSocketData - receive socket data */
 int ReceiveSocketData(SOCKET sock, void *buf, int len)
 {
+#ifdef LINUX
+    if (IoUringEnabled())
+        return IoUringRead(sock, buf, len, -1);
+#endif
     return recv(sock, buf, len, 0);
 }
 
 /* ReceiveSocketDataTimeout - receive socket data */
 int ReceiveSocketDataTimeout(SOCKET sock, void *buf, int len, int timeout)
 {
-    struct timeval toval;
-    fd_set set;
-
-    FD_ZERO(&set);
-    FD_SET(sock, &set);
-
-    toval.tv_sec = timeout / 1000;
-    toval.tv_usec = (timeout % 1000) * 1000;
+#ifdef LINUX
+    if (IoUringEnabled())
+        return IoUringRead(sock, buf, len, timeout);
+#endif
+    if (WaitSocket(sock, IO_READ, timeout) > 0)
+        return (int)recv(sock, buf, len, 0);
+    return -1;
+}
 
-    if (select(sock + 1, &set, NULL, NULL, &toval) > 0) {
-        if (FD_ISSET(sock, &set)) {
-            int bytes = (int)recv(sock, buf, len, 0);
-            return bytes;
-        }
-    }
+/* ReceiveSocketDataFunc - ReceiveSocketDataTimeout for xbReceiveExactDeadline (a closed connection is an error) */
+static int ReceiveSocketDataFunc(void *handle, void *buf, int len, int timeout)
+{
+    return ReceiveSocketDataTimeout(*(SOCKET *)handle, buf, len, timeout);
+}
 
-    return -1;
+/* ReceiveSocketDataExactDeadline - receive exactly len bytes before a deadline (an xbMonotonicMicros time) */
+int ReceiveSocketDataExactDeadline(SOCKET sock, void *buf, int len, int64_t deadline)
+{
+    return xbReceiveExactDeadline(ReceiveSocketDataFunc, &sock, buf, len, deadline);
 }
 
-/* ReceiveSocketDataExactTimeout - receive an exact amount of socket data */
+/* ReceiveSocketDataExactTimeout - receive an exact amount of socket data within timeout milliseconds in all */
 int ReceiveSocketDataExactTimeout(SOCKET sock, void *buf, int len, int timeout)
 {
-    return ReceiveSocketDataTimeout(sock, buf, len, timeout);
+    return ReceiveSocketDataExactDeadline(sock, buf, len, xbDeadline(timeout));
 }
 
 /* ReceiveSocketDataAndAddress - receive socket data and sender's address */
@@ -407,13 +551,23 @@ void SocketTerminal(SOCKET sock, int check_for_exit, int pst_mode)
     struct termios oldt, newt;
     char buf[128], realbuf[256]; // double in case buf is filled with \r in PST mode
     ssize_t cnt;
-    fd_set set;
+    IoReadySet *ready;
+    int readyFd;
     int exit_char = 0xdead; /* not a valid character */
     int sawexit_char = 0;
     int sawexit_valid = 0; 
     int exitcode = 0;
     int continue_terminal = 1;
 
+    /* wait on the socket and the keyboard together */
+    if (!(ready = IoReadyCreate())
+    ||  IoReadyAdd(ready, sock, IO_READ) != 0
+    ||  IoReadyAdd(ready, STDIN_FILENO, IO_READ) != 0) {
+        message("Can't wait for terminal input");
+        IoReadyDestroy(ready);
+        return;
+    }
+
     tcgetattr(STDIN_FILENO, &oldt);
     newt = oldt;
     newt.c_lflag &= ~(ICANON | ECHO | ISIG);
@@ -433,11 +587,8 @@ void SocketTerminal(SOCKET sock, int check_for_exit, int pst_mode)
 #endif
 
     do {
-        FD_ZERO(&set);
-        FD_SET(sock, &set);
-        FD_SET(STDIN_FILENO, &set);
-        if (select(sock + 1, &set, NULL, NULL, NULL) > 0) {
-            if (FD_ISSET(sock, &set)) {
+        if (IoReadyWaitSet(ready, -1, &readyFd) > 0) {
+            if (readyFd == sock) {
                 if ((cnt = recv(sock, buf, sizeof(buf), 0)) > 0) {
                     int i;
                     // check for breaks
@@ -467,7 +618,7 @@ void SocketTerminal(SOCKET sock, int check_for_exit, int pst_mode)
                     write(fileno(stdout), realbuf, realbytes);
                 }
             }
-            if (FD_ISSET(STDIN_FILENO, &set)) {
+            if (readyFd == STDIN_FILENO) {
                 if ((cnt = read(STDIN_FILENO, buf, sizeof(buf))) > 0) {
                     int i;
                     for (i = 0; i < cnt; ++i) {
@@ -482,6 +633,7 @@ void SocketTerminal(SOCKET sock, int check_for_exit, int pst_mode)
 
 done:
     tcsetattr(STDIN_FILENO, TCSANOW, &oldt);
+    IoReadyDestroy(ready);
 
     if (sawexit_valid)
         exit(exitcode);
@@ -38,6 +38,10 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SO
 #include <unistd.h>
 #endif
 
+#if !defined(WIN32)
+#include <time.h>
+#endif
+
 typedef struct PathEntry PathEntry;
 struct PathEntry {
     PathEntry *next;
@@ -177,3 +181,95 @@ static const char *MakePath(PathEntry *entry, const char *name)
     sprintf(fullpath, "%s%c%s", entry->path, DIR_SEP, name);
     return fullpath;
 }
+
+/* xbMonotonicMicros - microseconds from an arbitrary starting point that is not affected by changes to the time of day */
+int64_t xbMonotonicMicros(void)
+{
+#if defined(WIN32)
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER count;
+    if (!frequency.QuadPart)
+        QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&count);
+    return (int64_t)(count.QuadPart / frequency.QuadPart) * 1000000
+         + (int64_t)(count.QuadPart % frequency.QuadPart) * 1000000 / frequency.QuadPart;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+#endif
+}
+
+/* xbDeadline - the deadline timeout milliseconds from now */
+int64_t xbDeadline(int timeout)
+{
+    return xbMonotonicMicros() + (int64_t)timeout * 1000;
+}
+
+/* xbMillisUntil - milliseconds left before a deadline rounded up (0 once it has passed) */
+int xbMillisUntil(int64_t deadline)
+{
+    int64_t remaining = deadline - xbMonotonicMicros();
+    return remaining > 0 ? (int)((remaining + 999) / 1000) : 0;
+}
+
+/* xbReceiveExactDeadline - receive exactly len bytes before a deadline however the data is split up on the way
+
+   returns len or -1 if the deadline passed first or receive failed
+*/
+int xbReceiveExactDeadline(xbReceiveFunc *receive, void *handle, void *buf, int len, int64_t deadline)
+{
+    uint8_t *ptr = (uint8_t *)buf;
+    int remaining = len;
+    int cnt;
+
+    while (remaining > 0) {
+        if ((cnt = (*receive)(handle, ptr, remaining, xbMillisUntil(deadline))) <= 0)
+            return -1;
+        remaining -= cnt;
+        ptr += cnt;
+    }
+
+    return len;
+}
+
+/* xbIoVecSize - total number of bytes in a scatter-gather list */
+int xbIoVecSize(const struct iovec *iov, int count)
+{
+    int size = 0;
+    while (--count >= 0)
+        size += (int)(iov++)->iov_len;
+    return size;
+}
+
+/* xbSendRestV - finish sending a scatter-gather list after a vectored send sent only its first sent bytes
+
+   returns the size of the whole list or -1 if send failed
+*/
+int xbSendRestV(xbSendFunc *send, void *handle, const struct iovec *iov, int count, int sent)
+{
+    int skip = sent, cnt, i;
+
+    for (i = 0; i < count; ++i) {
+        const uint8_t *ptr = (const uint8_t *)iov[i].iov_base;
+        int remaining = (int)iov[i].iov_len;
+
+        /* skip what has already gone */
+        if (skip >= remaining) {
+            skip -= remaining;
+            continue;
+        }
+        ptr += skip;
+        remaining -= skip;
+        skip = 0;
+
+        while (remaining > 0) {
+            if ((cnt = (*send)(handle, ptr, remaining)) <= 0)
+                return -1;
+            remaining -= cnt;
+            ptr += cnt;
+        }
+    }
+
+    return xbIoVecSize(iov, count);
+}
@@ -22,11 +22,23 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SO
 #ifndef __SYSTEM_H__
 #define __SYSTEM_H__
 
+/* scatter-gather lists for the vectored send functions (POSIX systems already have struct iovec) */
+#ifdef __MINGW32__
+#include <stddef.h>
+struct iovec {
+    void *iov_base;
+    size_t iov_len;
+};
+#else
+#include <sys/uio.h>
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 #include <stdarg.h>
+#include <stdint.h>
 
 #ifndef TRUE
 #define TRUE    1
@@ -48,6 +60,19 @@ int xbAddFilePath(const char *name);
 int xbAddEnvironmentPath(const char *name);
 int xbAddProgramPath(char *argv[]);
 FILE *xbOpenFileInPath(const char *name, const char *mode);
+int64_t xbMonotonicMicros(void);
+
+/* deadlines are xbMonotonicMicros() times; a receive function waits up to timeout milliseconds for data and returns
+   the number of bytes read (at most len) or -1 on a timeout or error */
+typedef int xbReceiveFunc(void *handle, void *buf, int len, int timeout);
+int64_t xbDeadline(int timeout);
+int xbMillisUntil(int64_t deadline);
+int xbReceiveExactDeadline(xbReceiveFunc *receive, void *handle, void *buf, int len, int64_t deadline);
+
+/* a send function sends up to len bytes and returns the number sent or -1 on an error */
+typedef int xbSendFunc(void *handle, const void *buf, int len);
+int xbIoVecSize(const struct iovec *iov, int count);
+int xbSendRestV(xbSendFunc *send, void *handle, const struct iovec *iov, int count, int sent);
 
 #ifdef __cplusplus
 }
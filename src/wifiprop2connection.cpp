@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include "wifiprop2connection.h"
+#include "wifipropconnection.h"
 #include "loader.h"
 #include "proploader.h"
 #include "base64.h"
@@ -16,7 +17,8 @@ WiFiProp2Connection::WiFiProp2Connection()
     : m_ipaddr(NULL),
       m_version(NULL),
       m_telnetSocket(INVALID_SOCKET),
-      m_resetPin(12)
+      m_resetPin(12),
+      m_quickAck(false)
 {
 }
 
@@ -74,8 +76,11 @@ int WiFiProp2Connection::connect()
     if (!m_ipaddr)
         return -1;
 
-    if (ConnectSocketTimeout(&m_telnetAddr, CONNECT_TIMEOUT, &m_telnetSocket) != 0)
+    SOCKET_PROFILE profile;
+    GetSocketProfile(config(), &profile);
+    if (ConnectSocketTimeout(&m_telnetAddr, CONNECT_TIMEOUT, &profile, &m_telnetSocket) != 0)
         return -1;
+    setSocketProfile(m_telnetSocket, &profile);
 
     message("connected - Chip Version = P2");
 
@@ -108,7 +113,8 @@ int WiFiProp2Connection::loadImage(const uint8_t *image, int imageSize, uint8_t
 {
     message("a) Load Image to Chip Version = P2");
 
-    uint8_t buffer[1024], *packet, *body;
+    struct iovec request[2];
+    uint8_t buffer[1024], *body;
     int hdrCnt, result, cnt;
     int loaderBaudRate;
 
@@ -125,13 +131,13 @@ Content-Length: %d\r\n\
 \r\n",
                       loaderBaudRate, m_resetPin, responseSize, imageSize);
 
-    if (!(packet = (uint8_t *)malloc(hdrCnt + imageSize)))
-        return -1;
+    /* send the header and the image straight from where they are */
+    request[0].iov_base = buffer;
+    request[0].iov_len = hdrCnt;
+    request[1].iov_base = (void *)image;
+    request[1].iov_len = imageSize;
 
-    memcpy(packet, buffer, hdrCnt);
-    memcpy(&packet[hdrCnt], image, imageSize);
-
-    if ((cnt = sendRequest(packet, hdrCnt + imageSize, buffer, sizeof(buffer) - 1, &result)) == -1)
+    if ((cnt = sendRequestV(request, 2, buffer, sizeof(buffer) - 1, &result)) == -1)
     {
         message("Load request failed");
         return -1;
@@ -234,7 +240,7 @@ int WiFiProp2Connection::loadImage(const uint8_t *image, int imageSize, LoadType
         loaderBaudRate = DEF_LOADER_BAUDRATE;
 
     // WX image buffer is limited to 2K
-    if (imageSize > 2048)
+    if (imageSize > WIFI_MAX_ROM_IMAGE_SIZE)
         return -1;
 
     // use the initial loader baud rate 
@@ -724,18 +730,42 @@ int WiFiProp2Connection::sendData(const uint8_t *buf, int len)
     return SendSocketData(m_telnetSocket, buf, len);
 }
 
+int WiFiProp2Connection::sendDataV(const struct iovec *iov, int count)
+{
+    if (!isOpen())
+        return -1;
+
+    return SendSocketDataV(m_telnetSocket, iov, count);
+}
+
 int WiFiProp2Connection::receiveDataTimeout(uint8_t *buf, int len, int timeout)
 {
     if (!isOpen())
         return -1;
-    return ReceiveSocketDataTimeout(m_telnetSocket, buf, len, timeout);
+    int cnt = ReceiveSocketDataTimeout(m_telnetSocket, buf, len, timeout);
+    if (m_quickAck)
+        SocketQuickAck(m_telnetSocket);
+    return cnt;
 }
 
 int WiFiProp2Connection::receiveDataExactTimeout(uint8_t *buf, int len, int timeout)
 {
     if (!isOpen())
         return -1;
-    return ReceiveSocketDataExactTimeout(m_telnetSocket, buf, len, timeout);
+    int cnt = ReceiveSocketDataExactTimeout(m_telnetSocket, buf, len, timeout);
+    if (m_quickAck)
+        SocketQuickAck(m_telnetSocket);
+    return cnt;
+}
+
+int WiFiProp2Connection::receiveDataExactDeadline(uint8_t *buf, int len, int64_t deadline)
+{
+    if (!isOpen())
+        return -1;
+    int cnt = ReceiveSocketDataExactDeadline(m_telnetSocket, buf, len, deadline);
+    if (m_quickAck)
+        SocketQuickAck(m_telnetSocket);
+    return cnt;
 }
 
 int WiFiProp2Connection::setBaudRate(int baudRate)
@@ -778,23 +808,46 @@ int WiFiProp2Connection::terminal(bool checkForExit, bool pstMode)
 
 int WiFiProp2Connection::sendRequest(uint8_t *req, int reqSize, uint8_t *res, int resMax, int *pResult)
 {
+    struct iovec iov;
+    iov.iov_base = req;
+    iov.iov_len = reqSize;
+    return sendRequestV(&iov, 1, res, resMax, pResult);
+}
+
+/* setSocketProfile - apply the tcp-* settings to a connection to the module and remember whether to keep
+   acknowledging at once */
+void WiFiProp2Connection::setSocketProfile(SOCKET sock, const SOCKET_PROFILE *profile)
+{
+    if (SetSocketProfile(sock, profile) != 0)
+        message("Can't set all of the TCP options");
+    if (sock == m_telnetSocket)
+        m_quickAck = profile->quickAck != 0;
+}
+
+/* sendRequestV - send a request made up of several buffers (the first holding the HTTP header) */
+int WiFiProp2Connection::sendRequestV(const struct iovec *req, int reqCount, uint8_t *res, int resMax, int *pResult)
+{
+    int reqSize = xbIoVecSize(req, reqCount);
+    SOCKET_PROFILE profile;
     SOCKET sock;
     char buf[80];
     int cnt;
 
-    if (ConnectSocketTimeout(&m_httpAddr, CONNECT_TIMEOUT, &sock) != 0)
+    GetSocketProfile(config(), &profile);
+    if (ConnectSocketTimeout(&m_httpAddr, CONNECT_TIMEOUT, &profile, &sock) != 0)
     {
         message("Connect failed");
         return -1;
     }
+    setSocketProfile(sock, &profile);
 
     if (verbose > 1)
     {
         printf("REQ: %d\n", reqSize);
-        dumpHdr(req, reqSize);
+        dumpHdr((uint8_t *)req[0].iov_base, (int)req[0].iov_len);
     }
 
-    if (SendSocketData(sock, req, reqSize) != reqSize)
+    if (SendSocketDataV(sock, req, reqCount) != reqSize)
     {
         message("Send request failed");
         CloseSocket(sock);
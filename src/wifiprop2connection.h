@@ -6,6 +6,7 @@
 #include "propconnection.h"
 #include "sock.h"
 #include "wifiinfo.h"
+#include "wifipropconnection.h"
 
 #define WIFI_REQUIRED_MAJOR_VERSION         "v1."
 #define WIFI_REQUIRED_MAJOR_VERSION_LEGACY  "02-"
@@ -40,15 +41,23 @@ public:
     int loadImage(const uint8_t *image, int imageSize, uint8_t *response, int responseSize);
     int loadImage(const uint8_t *image, int imageSize, LoadType loadType = ltDownloadAndRun, int info = false);
     int sendData(const uint8_t *buf, int len);
+    int sendDataV(const struct iovec *iov, int count);
     int receiveData(const uint8_t *buf, int len);
     int receiveDataTimeout(uint8_t *buf, int len, int timeout);
     int receiveDataExactTimeout(uint8_t *buf, int len, int timeout);
+    int receiveDataExactDeadline(uint8_t *buf, int len, int64_t deadline);
     int setBaudRate(int baudRate);
-    int maxDataSize() { return 1024; }
+    bool baudRateSupported(int baudRate) { return baudRate > 0 && baudRate <= WIFI_MAX_BAUDRATE; }
+    int maxDataSize() { return WIFI_MAX_DATA_SIZE; }
+    int maxRomImageSize() { return WIFI_MAX_ROM_IMAGE_SIZE; }
+    int defaultRoundTripTime() { return WIFI_ROUND_TRIP_TIME; }
+    int receiveLatency() { return -1; }
     int terminal(bool checkForExit, bool pstMode);
     static int findModules(bool show, WiFiInfoList &list, int count = -1);
 private:
     int sendRequest(uint8_t *req, int reqSize, uint8_t *res, int resMax, int *pResult);
+    int sendRequestV(const struct iovec *req, int reqCount, uint8_t *res, int resMax, int *pResult);
+    void setSocketProfile(SOCKET sock, const SOCKET_PROFILE *profile);
     static uint8_t *getBody(uint8_t *msg, int msgSize, int *pBodySize);
     static void dumpHdr(const uint8_t *buf, int size);
     static void dumpResponse(const uint8_t *buf, int size);
@@ -58,6 +67,7 @@ private:
     SOCKADDR_IN m_telnetAddr;
     SOCKET m_telnetSocket;
     int m_resetPin;
+    bool m_quickAck;
 };
 
 #endif // WIFIPROP2CONNECTION_H
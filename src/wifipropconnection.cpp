@@ -3,6 +3,7 @@
 #include <string.h>
 #include "wifipropconnection.h"
 #include "loader.h"
+#include "loadtrace.h"
 #include "proploader.h"
 
 #define CALIBRATE_DELAY 10
@@ -14,8 +15,10 @@
 WiFiPropConnection::WiFiPropConnection()
     : m_ipaddr(NULL),
       m_version(NULL),
+      m_deviceId(NULL),
       m_telnetSocket(INVALID_SOCKET),
-      m_resetPin(12)
+      m_resetPin(12),
+      m_quickAck(false)
 {
 }
 
@@ -23,9 +26,28 @@ WiFiPropConnection::~WiFiPropConnection()
 {
     if (m_ipaddr)
         free(m_ipaddr);
+    if (m_deviceId)
+        free(m_deviceId);
     disconnect();
 }
 
+/* GetSocketProfile - get the TCP options for connections to a module from the tcp-* settings; a small packet and its
+   acknowledgement should never wait for the other end's delayed acknowledgement so NODELAY and QUICKACK are on
+   unless turned off */
+void GetSocketProfile(BoardConfig *config, SOCKET_PROFILE *profile)
+{
+    memset(profile, 0, sizeof(*profile));
+    profile->noDelay = 1;
+    profile->quickAck = 1;
+    if (config) {
+        GetNumericConfigField(config, "tcp-nodelay", &profile->noDelay);
+        GetNumericConfigField(config, "tcp-quickack", &profile->quickAck);
+        GetNumericConfigField(config, "tcp-send-buffer", &profile->sendBufferSize);
+        GetNumericConfigField(config, "tcp-receive-buffer", &profile->receiveBufferSize);
+        GetNumericConfigField(config, "tcp-keepalive", &profile->keepAlive);
+    }
+}
+
 int WiFiPropConnection::setAddress(const char *ipaddr)
 {
     if (m_ipaddr)
@@ -35,6 +57,11 @@ int WiFiPropConnection::setAddress(const char *ipaddr)
         return -1;
     strcpy(m_ipaddr, ipaddr);
 
+    if (m_deviceId) {
+        free(m_deviceId);
+        m_deviceId = NULL;
+    }
+
     if (GetInternetAddress(m_ipaddr, HTTP_PORT, &m_httpAddr) != 0)
         return -1;
 
@@ -74,8 +101,11 @@ int WiFiPropConnection::connect()
     if (!m_ipaddr)
         return -1;
 
-    if (ConnectSocketTimeout(&m_telnetAddr, CONNECT_TIMEOUT, &m_telnetSocket) != 0)
+    SOCKET_PROFILE profile;
+    GetSocketProfile(config(), &profile);
+    if (ConnectSocketTimeout(&m_telnetAddr, CONNECT_TIMEOUT, &profile, &m_telnetSocket) != 0)
         return -1;
+    setSocketProfile(m_telnetSocket, &profile);
 
     return 0;
 }
@@ -106,9 +136,11 @@ int WiFiPropConnection::loadImage(const uint8_t *image, int imageSize, uint8_t *
 {
     message("a) Load Image to Chip Version = P1");
     
-    uint8_t buffer[1024], *packet, *body;
+    struct iovec request[2];
+    uint8_t buffer[1024], *body;
     int hdrCnt, result, cnt;
     int loaderBaudRate;
+    int64_t phaseStart;
     
     if (!GetNumericConfigField(config(), "loader-baud-rate", &loaderBaudRate))
         loaderBaudRate = DEF_LOADER_BAUDRATE;
@@ -122,13 +154,16 @@ POST /propeller/load?baud-rate=%d&reset-pin=%d&response-size=%d&response-timeout
 Content-Length: %d\r\n\
 \r\n", loaderBaudRate, m_resetPin, responseSize, imageSize);
 
-    if (!(packet = (uint8_t *)malloc(hdrCnt + imageSize)))
-        return -1;
+    /* send the header and the image straight from where they are */
+    request[0].iov_base = buffer;
+    request[0].iov_len = hdrCnt;
+    request[1].iov_base = (void *)image;
+    request[1].iov_len = imageSize;
 
-    memcpy(packet,  buffer, hdrCnt);
-    memcpy(&packet[hdrCnt], image, imageSize);
-    
-    if ((cnt = sendRequest(packet, hdrCnt + imageSize, buffer, sizeof(buffer) - 1, &result)) == -1) {
+    phaseStart = LoadTraceTime();
+    cnt = sendRequestV(request, 2, buffer, sizeof(buffer) - 1, &result);
+    LoadTracePhase("load-request", phaseStart, imageSize, loaderBaudRate);
+    if (cnt == -1) {
         message("Load request failed");
         return -1;
     }
@@ -188,15 +223,17 @@ int WiFiPropConnection::loadImage(const uint8_t *image, int imageSize, LoadType
 {
     message("b) Load Image to Chip Version = P1");
     
-    uint8_t buffer[1024], *packet;
+    struct iovec request[2];
+    uint8_t buffer[1024];
     int hdrCnt, result, cnt;
     int loaderBaudRate;
+    int64_t phaseStart;
     
     if (!GetNumericConfigField(config(), "loader-baud-rate", &loaderBaudRate))
         loaderBaudRate = DEF_LOADER_BAUDRATE;
     
     /* WX image buffer is limited to 2K */
-    if (imageSize > 2048)
+    if (imageSize > WIFI_MAX_ROM_IMAGE_SIZE)
         return -1;
     
     /* use the initial loader baud rate */
@@ -208,13 +245,16 @@ POST /propeller/load?baud-rate=%d HTTP/1.1\r\n\
 Content-Length: %d\r\n\
 \r\n", loaderBaudRate, imageSize);
 
-    if (!(packet = (uint8_t *)malloc(hdrCnt + imageSize)))
-        return -1;
+    /* send the header and the image straight from where they are */
+    request[0].iov_base = buffer;
+    request[0].iov_len = hdrCnt;
+    request[1].iov_base = (void *)image;
+    request[1].iov_len = imageSize;
 
-    memcpy(packet,  buffer, hdrCnt);
-    memcpy(&packet[hdrCnt], image, imageSize);
-    
-    if ((cnt = sendRequest(packet, hdrCnt + imageSize, buffer, sizeof(buffer), &result)) == -1) {
+    phaseStart = LoadTraceTime();
+    cnt = sendRequestV(request, 2, buffer, sizeof(buffer), &result);
+    LoadTracePhase("load-request", phaseStart, imageSize, loaderBaudRate);
+    if (cnt == -1) {
         message("Load request failed");
         return -1;
     }
@@ -465,6 +505,34 @@ GET /wx/setting?name=version HTTP/1.1\r\n\
     return 0;
 }
 
+/* deviceId - name the module by its station MAC address since DHCP can give it a different IP address; the IP
+   address is used if the module doesn't report its MAC address */
+const char *WiFiPropConnection::deviceId()
+{
+    uint8_t buffer[1024], *body;
+    int hdrCnt, result, cnt;
+
+    if (m_deviceId)
+        return m_deviceId;
+
+    hdrCnt = snprintf((char *)buffer, sizeof(buffer), "\
+GET /wx/setting?name=station-mac-address HTTP/1.1\r\n\
+\r\n");
+
+    if ((cnt = sendRequest(buffer, hdrCnt, buffer, sizeof(buffer), &result)) == -1 || result != 200
+    ||  !(body = getBody(buffer, cnt, &cnt)) || cnt <= 0) {
+        body = (uint8_t *)portName();
+        cnt = strlen(portName());
+    }
+
+    if (!(m_deviceId = (char *)malloc(cnt + 1)))
+        return portName();
+    strncpy(m_deviceId, (char *)body, cnt);
+    m_deviceId[cnt] = '\0';
+
+    return m_deviceId;
+}
+
 int WiFiPropConnection::setName(const char *name)
 {
     uint8_t buffer[1024];
@@ -544,18 +612,41 @@ int WiFiPropConnection::sendData(const uint8_t *buf, int len)
     return SendSocketData(m_telnetSocket, buf, len);
 }
 
+int WiFiPropConnection::sendDataV(const struct iovec *iov, int count)
+{
+    if (!isOpen())
+        return -1;
+    return SendSocketDataV(m_telnetSocket, iov, count);
+}
+
 int WiFiPropConnection::receiveDataTimeout(uint8_t *buf, int len, int timeout)
 {
     if (!isOpen())
         return -1;
-    return ReceiveSocketDataTimeout(m_telnetSocket, buf, len, timeout);
+    int cnt = ReceiveSocketDataTimeout(m_telnetSocket, buf, len, timeout);
+    if (m_quickAck)
+        SocketQuickAck(m_telnetSocket);
+    return cnt;
 }
 
 int WiFiPropConnection::receiveDataExactTimeout(uint8_t *buf, int len, int timeout)
 {
     if (!isOpen())
         return -1;
-    return ReceiveSocketDataExactTimeout(m_telnetSocket, buf, len, timeout);
+    int cnt = ReceiveSocketDataExactTimeout(m_telnetSocket, buf, len, timeout);
+    if (m_quickAck)
+        SocketQuickAck(m_telnetSocket);
+    return cnt;
+}
+
+int WiFiPropConnection::receiveDataExactDeadline(uint8_t *buf, int len, int64_t deadline)
+{
+    if (!isOpen())
+        return -1;
+    int cnt = ReceiveSocketDataExactDeadline(m_telnetSocket, buf, len, deadline);
+    if (m_quickAck)
+        SocketQuickAck(m_telnetSocket);
+    return cnt;
 }
 
 int WiFiPropConnection::setBaudRate(int baudRate)
@@ -594,21 +685,44 @@ int WiFiPropConnection::terminal(bool checkForExit, bool pstMode)
 
 int WiFiPropConnection::sendRequest(uint8_t *req, int reqSize, uint8_t *res, int resMax, int *pResult)
 {
+    struct iovec iov;
+    iov.iov_base = req;
+    iov.iov_len = reqSize;
+    return sendRequestV(&iov, 1, res, resMax, pResult);
+}
+
+/* setSocketProfile - apply the tcp-* settings to a connection to the module and remember whether to keep
+   acknowledging at once */
+void WiFiPropConnection::setSocketProfile(SOCKET sock, const SOCKET_PROFILE *profile)
+{
+    if (SetSocketProfile(sock, profile) != 0)
+        message("Can't set all of the TCP options");
+    if (sock == m_telnetSocket)
+        m_quickAck = profile->quickAck != 0;
+}
+
+/* sendRequestV - send a request made up of several buffers (the first holding the HTTP header) */
+int WiFiPropConnection::sendRequestV(const struct iovec *req, int reqCount, uint8_t *res, int resMax, int *pResult)
+{
+    int reqSize = xbIoVecSize(req, reqCount);
+    SOCKET_PROFILE profile;
     SOCKET sock;
     char buf[80];
     int cnt;
     
-    if (ConnectSocketTimeout(&m_httpAddr, CONNECT_TIMEOUT, &sock) != 0) {
+    GetSocketProfile(config(), &profile);
+    if (ConnectSocketTimeout(&m_httpAddr, CONNECT_TIMEOUT, &profile, &sock) != 0) {
         message("Connect failed");
         return -1;
     }
+    setSocketProfile(sock, &profile);
     
     if (verbose > 1) {
         printf("REQ: %d\n", reqSize);
-        dumpHdr(req, reqSize);
+        dumpHdr((uint8_t *)req[0].iov_base, (int)req[0].iov_len);
     }
     
-    if (SendSocketData(sock, req, reqSize) != reqSize) {
+    if (SendSocketDataV(sock, req, reqCount) != reqSize) {
         message("Send request failed");
         CloseSocket(sock);
         return -1;
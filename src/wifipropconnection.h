@@ -16,6 +16,19 @@
 #define DISCOVER_REPLY_TIMEOUT      250
 #define DISCOVER_ATTEMPTS           3
 
+// highest baud rate the loader will ask the module's serial port to use
+#define WIFI_MAX_BAUDRATE           921600
+
+// the module buffers an image for the ROM boot loader in 2K
+#define WIFI_MAX_ROM_IMAGE_SIZE     2048
+
+// typical round trip latency in microseconds through the module before one has been measured
+#define WIFI_ROUND_TRIP_TIME        20000
+
+// largest packet payload that keeps each packet (with its 8 byte header) within one TCP segment so the module
+// forwards it to the Propeller without a gap
+#define WIFI_MAX_DATA_SIZE          (1460 - 8)
+
 class WiFiPropConnection : public PropConnection
 {
 public:
@@ -36,23 +49,36 @@ public:
     int loadImage(const uint8_t *image, int imageSize, uint8_t *response, int responseSize);
     int loadImage(const uint8_t *image, int imageSize, LoadType loadType = ltDownloadAndRun, int info = false);
     int sendData(const uint8_t *buf, int len);
+    int sendDataV(const struct iovec *iov, int count);
     int receiveDataTimeout(uint8_t *buf, int len, int timeout);
     int receiveDataExactTimeout(uint8_t *buf, int len, int timeout);
+    int receiveDataExactDeadline(uint8_t *buf, int len, int64_t deadline);
     int setBaudRate(int baudRate);
-    int maxDataSize() { return 1024; }
+    bool baudRateSupported(int baudRate) { return baudRate > 0 && baudRate <= WIFI_MAX_BAUDRATE; }
+    int maxDataSize() { return WIFI_MAX_DATA_SIZE; }
+    int maxRomImageSize() { return WIFI_MAX_ROM_IMAGE_SIZE; }
+    int defaultRoundTripTime() { return WIFI_ROUND_TRIP_TIME; }
+    int receiveLatency() { return -1; }
     int terminal(bool checkForExit, bool pstMode);
+    const char *deviceId();
     static int findModules(bool show, WiFiInfoList &list, int count = -1);
 private:
     int sendRequest(uint8_t *req, int reqSize, uint8_t *res, int resMax, int *pResult);
+    int sendRequestV(const struct iovec *req, int reqCount, uint8_t *res, int resMax, int *pResult);
+    void setSocketProfile(SOCKET sock, const SOCKET_PROFILE *profile);
     static uint8_t *getBody(uint8_t *msg, int msgSize, int *pBodySize);
     static void dumpHdr(const uint8_t *buf, int size);
     static void dumpResponse(const uint8_t *buf, int size);
     char *m_ipaddr;
     char *m_version;
+    char *m_deviceId;
     SOCKADDR_IN m_httpAddr;
     SOCKADDR_IN m_telnetAddr;
     SOCKET m_telnetSocket;
     int m_resetPin;
+    bool m_quickAck;
 };
 
+void GetSocketProfile(BoardConfig *config, SOCKET_PROFILE *profile);
+
 #endif // WIFIPROPCONNECTION_H
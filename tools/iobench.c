@@ -0,0 +1,206 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include "serial.h"
+#include "sock.h"
+#include "iouring.h"
+
+/* a full size fast loader packet (packet id, transaction id and data) and its acknowledgement */
+#define PACKET_SIZE     1392
+#define ACK_SIZE        8
+
+/* packets each connection sends */
+#define PACKETS         2000
+
+/* most connections loading at once */
+#define MAX_CONNECTIONS 16
+
+/* time to wait for an acknowledgement */
+#define ACK_TIMEOUT     1000
+
+typedef enum {
+    TRANSPORT_PTY,
+    TRANSPORT_TCP
+} Transport;
+
+typedef struct {
+    Transport transport;
+    SERIAL *serial;     /* the loader's end of a pseudo terminal */
+    SOCKET sock;        /* or of a loopback connection */
+    int peer;           /* the Propeller's end */
+    int failed;
+} Connection;
+
+/* the loader's messages aren't interesting here */
+void message(const char *fmt, ...)
+{
+}
+
+static double Seconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* Peer - receive each packet on the Propeller's end and acknowledge it (always with plain reads and writes) */
+static void *Peer(void *data)
+{
+    Connection *c = (Connection *)data;
+    uint8_t packet[PACKET_SIZE], ack[ACK_SIZE];
+    int i, cnt, n;
+
+    memset(ack, 0, sizeof(ack));
+    for (i = 0; i < PACKETS; ++i) {
+        for (cnt = 0; cnt < PACKET_SIZE; cnt += n) {
+            if ((n = read(c->peer, packet + cnt, PACKET_SIZE - cnt)) <= 0)
+                return NULL;
+        }
+        memcpy(ack, packet, 4);
+        if (write(c->peer, ack, ACK_SIZE) != ACK_SIZE)
+            return NULL;
+    }
+
+    return NULL;
+}
+
+/* Host - send packets the way the fast loader does, waiting for each acknowledgement */
+static void *Host(void *data)
+{
+    Connection *c = (Connection *)data;
+    uint8_t packet[PACKET_SIZE], ack[ACK_SIZE];
+    int i, cnt;
+
+    memset(packet, 0x55, sizeof(packet));
+    for (i = 0; i < PACKETS; ++i) {
+        memcpy(packet, &i, 4);
+        if (c->transport == TRANSPORT_PTY) {
+            cnt = SendSerialData(c->serial, packet, PACKET_SIZE);
+            if (cnt == PACKET_SIZE)
+                cnt = ReceiveSerialDataExactTimeout(c->serial, ack, ACK_SIZE, ACK_TIMEOUT);
+        }
+        else {
+            cnt = SendSocketData(c->sock, packet, PACKET_SIZE);
+            if (cnt == PACKET_SIZE)
+                cnt = ReceiveSocketDataExactTimeout(c->sock, ack, ACK_SIZE, ACK_TIMEOUT);
+        }
+        if (cnt != ACK_SIZE || memcmp(ack, &i, 4) != 0) {
+            c->failed = 1;
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+static int OpenPty(Connection *c)
+{
+    const char *name;
+
+    if ((c->peer = posix_openpt(O_RDWR | O_NOCTTY)) < 0)
+        return -1;
+    if (grantpt(c->peer) != 0 || unlockpt(c->peer) != 0 || !(name = ptsname(c->peer)))
+        return -1;
+    return OpenSerial(name, 115200, &c->serial);
+}
+
+static int OpenTcp(Connection *c)
+{
+    SOCKADDR_IN addr;
+    socklen_t addrLen = sizeof(addr);
+    SOCKET listener;
+    int one = 1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if ((listener = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+        return -1;
+    if (bind(listener, (SOCKADDR *)&addr, sizeof(addr)) != 0
+    ||  listen(listener, 1) != 0
+    ||  getsockname(listener, (SOCKADDR *)&addr, &addrLen) != 0
+    ||  ConnectSocket(&addr, NULL, &c->sock) != 0
+    ||  (c->peer = accept(listener, NULL, NULL)) < 0) {
+        close(listener);
+        return -1;
+    }
+    close(listener);
+
+    setsockopt(c->sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    setsockopt(c->peer, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return 0;
+}
+
+/* Bench - load count connections at once and report the packet rate and round trip time */
+static int Bench(Transport transport, int count, int useIoUring)
+{
+    static Connection connections[MAX_CONNECTIONS];
+    pthread_t hosts[MAX_CONNECTIONS], peers[MAX_CONNECTIONS];
+    double start, elapsed;
+    int failed = 0, i;
+
+    IoUringEnable(useIoUring);
+
+    memset(connections, 0, sizeof(connections));
+    for (i = 0; i < count; ++i) {
+        Connection *c = &connections[i];
+        c->transport = transport;
+        if ((transport == TRANSPORT_PTY ? OpenPty(c) : OpenTcp(c)) != 0) {
+            fprintf(stderr, "error: can't open connection %d\n", i);
+            return 1;
+        }
+    }
+
+    start = Seconds();
+    for (i = 0; i < count; ++i) {
+        pthread_create(&peers[i], NULL, Peer, &connections[i]);
+        pthread_create(&hosts[i], NULL, Host, &connections[i]);
+    }
+    for (i = 0; i < count; ++i) {
+        pthread_join(hosts[i], NULL);
+        failed |= connections[i].failed;
+    }
+    elapsed = Seconds() - start;
+
+    for (i = 0; i < count; ++i) {
+        Connection *c = &connections[i];
+        if (transport == TRANSPORT_PTY)
+            CloseSerial(c->serial);
+        else
+            CloseSocket(c->sock);
+        close(c->peer);
+        pthread_join(peers[i], NULL);
+    }
+
+    printf("%-9s %11d %-10s %10.0f %10.1f %s\n", transport == TRANSPORT_PTY ? "pty" : "tcp", count,
+           useIoUring ? "io_uring" : "blocking", PACKETS * count / elapsed, elapsed / PACKETS * 1e6,
+           failed ? "FAILED" : "");
+
+    return failed;
+}
+
+int main(int argc, char *argv[])
+{
+    static const int counts[] = { 1, 4, 16 };
+    int haveIoUring, failed = 0, t, i;
+
+    if ((haveIoUring = IoUringEnable(1) == 0) == 0)
+        printf("io_uring isn't available - benchmarking blocking transfers only\n");
+
+    printf("%-9s %11s %-10s %10s %10s\n", "transport", "connections", "backend", "packets/s", "rtt us");
+    for (t = TRANSPORT_PTY; t <= TRANSPORT_TCP; ++t) {
+        for (i = 0; i < (int)(sizeof(counts) / sizeof(counts[0])); ++i) {
+            failed |= Bench((Transport)t, counts[i], 0);
+            if (haveIoUring)
+                failed |= Bench((Transport)t, counts[i], 1);
+        }
+    }
+
+    return failed;
+}
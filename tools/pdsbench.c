@@ -0,0 +1,154 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <limits.h>
+#include "pdsencode.h"
+
+/* size of the generated test images (all of hub RAM) */
+#define IMAGE_SIZE      32768
+
+/* worst case encoded size assuming one byte per bit */
+#define ENCODED_SIZE    (IMAGE_SIZE * 8)
+
+/* minimum CPU time to spend timing each encoder on each image */
+#define MIN_SECONDS     0.5
+
+/* bits encoded by each byte the ROM boot loader accepts (a low pulse of one bit period is a 1 and two bit periods is
+   a 0, counting the start bit) or a count of zero for bytes it rejects */
+static struct {
+    int count;
+    int bits;
+} tokens[256];
+
+typedef int (*Encoder)(const uint8_t *inBytes, int inCount, uint8_t *outBytes, int outSize);
+
+/* time an encoder and return its throughput in megabytes of input per second */
+static double Throughput(Encoder encode, const uint8_t *image, int imageSize, uint8_t *encoded)
+{
+    clock_t start = clock(), elapsed;
+    long iterations = 0;
+
+    do {
+        encode(image, imageSize, encoded, ENCODED_SIZE);
+        ++iterations;
+    } while ((elapsed = clock() - start) < MIN_SECONDS * CLOCKS_PER_SEC);
+
+    return (double)imageSize * iterations / 1e6 / ((double)elapsed / CLOCKS_PER_SEC);
+}
+
+/* DecodeTokens - work out the bits each byte encodes from the ROM boot loader's pulse widths */
+static void DecodeTokens(void)
+{
+    int byte, level, run, i;
+
+    for (byte = 0; byte < 256; ++byte) {
+        int levels = (byte << 1) | 0x200; /* start bit, 8 data bits lsb first and the stop bit */
+        tokens[byte].count = 0;
+        tokens[byte].bits = 0;
+        for (i = 0, run = 0; i < 10; ++i) {
+            level = (levels >> i) & 1;
+            if (!level)
+                ++run;
+            else if (run > 0) {
+                if (run > 2) {
+                    tokens[byte].count = 0;
+                    break;
+                }
+                tokens[byte].bits |= (run == 1 ? 1 : 0) << tokens[byte].count++;
+                run = 0;
+            }
+        }
+    }
+}
+
+/* OptimalSize - fewest bytes that can encode an image found by a dynamic program over its bit positions */
+static int OptimalSize(const uint8_t *image, int imageSize)
+{
+    int bitCount = imageSize * 8, byte, bit, i;
+    int *cost;
+
+    if (!(cost = (int *)malloc((bitCount + 1) * sizeof(int))))
+        return -1;
+
+    /* cost[bit] is the fewest bytes encoding the bits from bit to the end */
+    cost[bitCount] = 0;
+    for (bit = bitCount - 1; bit >= 0; --bit) {
+        cost[bit] = INT_MAX;
+        for (byte = 0; byte < 256; ++byte) {
+            int count = tokens[byte].count;
+            if (count == 0 || bit + count > bitCount || cost[bit + count] == INT_MAX)
+                continue;
+            for (i = 0; i < count; ++i)
+                if (((image[(bit + i) / 8] >> ((bit + i) % 8)) & 1) != ((tokens[byte].bits >> i) & 1))
+                    break;
+            if (i == count && cost[bit + count] + 1 < cost[bit])
+                cost[bit] = cost[bit + count] + 1;
+        }
+    }
+
+    i = cost[0];
+    free(cost);
+    return i;
+}
+
+static int Bench(const char *name, const uint8_t *image, int imageSize)
+{
+    static uint8_t bitsEncoded[ENCODED_SIZE], bytesEncoded[ENCODED_SIZE];
+    int bitsSize, bytesSize, optimalSize;
+    double bitsRate, bytesRate;
+
+    bitsSize = PDSEncodeBits(image, imageSize, bitsEncoded, sizeof(bitsEncoded));
+    bytesSize = PDSEncodeBytes(image, imageSize, bytesEncoded, sizeof(bytesEncoded));
+    if (bitsSize != bytesSize || memcmp(bitsEncoded, bytesEncoded, bitsSize) != 0) {
+        printf("%-16s encoders disagree\n", name);
+        return 1;
+    }
+
+    optimalSize = OptimalSize(image, imageSize);
+    bitsRate = Throughput(PDSEncodeBits, image, imageSize, bitsEncoded);
+    bytesRate = Throughput(PDSEncodeBytes, image, imageSize, bytesEncoded);
+    printf("%-16s %6d %7d %7d %5d %10.1f %10.1f %7.1fx\n", name, imageSize, bytesSize, optimalSize, bytesSize - optimalSize,
+           bitsRate, bytesRate, bytesRate / bitsRate);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    static uint8_t image[IMAGE_SIZE];
+    int failed = 0, size, i;
+    FILE *fp;
+
+    DecodeTokens();
+    printf("%-16s %6s %7s %7s %5s %10s %10s %8s\n", "image", "bytes", "encoded", "optimal", "saved", "bits MB/s",
+           "bytes MB/s", "speedup");
+
+    /* benchmark any images given on the command line */
+    if (argc > 1) {
+        for (i = 1; i < argc; ++i) {
+            if (!(fp = fopen(argv[i], "rb"))) {
+                fprintf(stderr, "error: can't open '%s'\n", argv[i]);
+                return 1;
+            }
+            size = fread(image, 1, sizeof(image), fp);
+            fclose(fp);
+            failed |= Bench(argv[i], image, size);
+        }
+        return failed;
+    }
+
+    /* otherwise benchmark generated 32K images */
+    memset(image, 0, sizeof(image));
+    failed |= Bench("zeros", image, sizeof(image));
+    memset(image, 0xff, sizeof(image));
+    failed |= Bench("ones", image, sizeof(image));
+    srand(1);
+    for (i = 0; i < IMAGE_SIZE; ++i)
+        image[i] = rand() >> 4;
+    failed |= Bench("random", image, sizeof(image));
+    memset(image + IMAGE_SIZE / 2, 0, IMAGE_SIZE / 2);
+    failed |= Bench("half-random", image, sizeof(image));
+
+    return failed;
+}
@@ -28,7 +28,9 @@ static char *overlayNames[] = {
     "verifyRAM",
     "programVerifyEEPROM",
     "readyToLaunch",
-    "launchNow"
+    "launchNow",
+    "startWindow",
+    "decompressImage"
 };
 static int overlayNameCount = sizeof(overlayNames) / sizeof(char *);
 
@@ -128,6 +130,9 @@ int main(int argc, char *argv[])
     DumpSpinHdr(ofp, "patched", hdr);
 #endif
     
+    /* the Loader's 11 host-initialized longs are the last DAT longs before the overlays; the Spin code follows them */
+    fprintf(ofp, "#define RAW_LOADER_INIT_OFFSET_FROM_END (-(11 * 4) - %d)\n\n", imageSize - oldSpinCodeOffset);
+    
     fprintf(ofp, "static uint8_t rawLoaderImage[] = {");
     DumpRange(ofp, image, 0, firstOverlayMarker); putc(',', ofp);
     DumpRange(ofp, image, oldSpinCodeOffset, imageSize);
@@ -0,0 +1,151 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include "sock.h"
+
+/* a fast loader packet as the Wi-Fi module passes it on (header and data) and its acknowledgement */
+#define HEADER_SIZE     8
+#define PACKET_SIZE     1032
+#define ACK_SIZE        8
+
+/* packets sent for each measurement */
+#define PACKETS         200
+
+/* time to wait for an acknowledgement */
+#define ACK_TIMEOUT     1000
+
+typedef struct {
+    SOCKET listener;
+    SOCKET peer;
+} Server;
+
+/* the loader's messages aren't interesting here */
+void message(const char *fmt, ...)
+{
+}
+
+static double Seconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* Serve - stand in for the module's telnet port: acknowledge each whole packet (with default socket options) */
+static void *Serve(void *data)
+{
+    Server *s = (Server *)data;
+    uint8_t packet[PACKET_SIZE], ack[ACK_SIZE];
+    int cnt, n;
+
+    memset(ack, 0, sizeof(ack));
+    for (;;) {
+        for (cnt = 0; cnt < PACKET_SIZE; cnt += n) {
+            if ((n = recv(s->peer, packet + cnt, PACKET_SIZE - cnt, 0)) <= 0)
+                return NULL;
+        }
+        memcpy(ack, packet, 4);
+        if (send(s->peer, ack, ACK_SIZE, 0) != ACK_SIZE)
+            return NULL;
+    }
+}
+
+static int Open(Server *s, SOCKET *pSock)
+{
+    SOCKADDR_IN addr;
+    socklen_t addrLen = sizeof(addr);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if ((s->listener = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+        return -1;
+    if (bind(s->listener, (SOCKADDR *)&addr, sizeof(addr)) != 0
+    ||  listen(s->listener, 1) != 0
+    ||  getsockname(s->listener, (SOCKADDR *)&addr, &addrLen) != 0
+    ||  ConnectSocket(&addr, NULL, pSock) != 0
+    ||  (s->peer = accept(s->listener, NULL, NULL)) < 0) {
+        close(s->listener);
+        return -1;
+    }
+    close(s->listener);
+    return 0;
+}
+
+/* Measure - send packets as one buffer or as a header and data and report the round trip time */
+static int Measure(int split, int tuned)
+{
+    SOCKET_PROFILE profile;
+    uint8_t packet[PACKET_SIZE], ack[ACK_SIZE];
+    double start, rtt, total = 0, worst = 0;
+    pthread_t server;
+    SOCKET sock;
+    Server s;
+    int failed = 0, cnt, i;
+
+    if (Open(&s, &sock) != 0) {
+        fprintf(stderr, "error: can't open connection\n");
+        return 1;
+    }
+
+    /* the profile the loader uses for the module's telnet port by default */
+    if (tuned) {
+        memset(&profile, 0, sizeof(profile));
+        profile.noDelay = 1;
+        profile.quickAck = 1;
+        if (SetSocketProfile(sock, &profile) != 0)
+            fprintf(stderr, "warning: can't set all of the TCP options\n");
+    }
+
+    pthread_create(&server, NULL, Serve, &s);
+
+    memset(packet, 0x55, sizeof(packet));
+    for (i = 0; i < PACKETS; ++i) {
+        memcpy(packet, &i, 4);
+        start = Seconds();
+        if (split)
+            cnt = SendSocketData(sock, packet, HEADER_SIZE) == HEADER_SIZE
+               && SendSocketData(sock, packet + HEADER_SIZE, PACKET_SIZE - HEADER_SIZE) == PACKET_SIZE - HEADER_SIZE
+                ? PACKET_SIZE : -1;
+        else
+            cnt = SendSocketData(sock, packet, PACKET_SIZE);
+        if (cnt == PACKET_SIZE)
+            cnt = ReceiveSocketDataExactTimeout(sock, ack, ACK_SIZE, ACK_TIMEOUT);
+        if (tuned)
+            SocketQuickAck(sock);
+        rtt = Seconds() - start;
+        if (cnt != ACK_SIZE || memcmp(ack, &i, 4) != 0) {
+            failed = 1;
+            break;
+        }
+        total += rtt;
+        if (rtt > worst)
+            worst = rtt;
+    }
+
+    CloseSocket(sock);
+    pthread_join(server, NULL);
+    close(s.peer);
+
+    printf("%-17s %-8s %10.1f %10.1f %s\n", split ? "header + data" : "one buffer", tuned ? "tuned" : "default",
+           i ? total / i * 1e6 : 0, worst * 1e6, failed ? "FAILED" : "");
+
+    return failed;
+}
+
+int main(int argc, char *argv[])
+{
+    int failed = 0, split, tuned;
+
+    printf("%-17s %-8s %10s %10s\n", "packet", "profile", "mean us", "max us");
+    for (split = 0; split <= 1; ++split) {
+        for (tuned = 0; tuned <= 1; ++tuned)
+            failed |= Measure(split, tuned);
+    }
+
+    return failed;
+}